@@ -0,0 +1,131 @@
+/*!
+ * @file bptree_bench.cpp
+ * @author Luminolt
+ * @brief lookups per second on a shared bptree as reader threads are added
+ *
+ * usage: bptree_bench [keys] [seconds per run] [max threads] [writer 0/1] [crabbing/optimistic]
+ * Each run starts that many reader threads doing random point reads, and
+ * with writer=1 one more thread inserting and removing keys meanwhile.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bptree.h"
+
+using crabbing_tree = bptree<int, int>;
+using optimistic_tree = bptree<int, int, DEFAULT_PAGE_SIZE, false, optimistic_latching>;
+
+// keeps the reads from being optimized away
+static std::atomic<int> sink(0);
+
+// one run, returns lookups per second
+template <class TREE>
+static double run(TREE &tree, int keys, double seconds, int readers, bool writer) {
+    std::atomic<bool> stop(false);
+    std::vector<long long> done(readers, 0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            std::mt19937 rng(r + 1);
+            std::uniform_int_distribution<int> pick(0, keys - 1);
+            long long count = 0;
+            int sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                // even keys are always there
+                tree.read(pick(rng) & ~1, [&](const int &value) { sum += value; });
+                count++;
+            }
+            done[r] = count;
+            sink += sum;
+        });
+    }
+    if (writer) {
+        threads.emplace_back([&] {
+            std::mt19937 rng(0);
+            std::uniform_int_distribution<int> pick(0, keys / 2 - 1);
+            std::vector<bool> present(keys / 2, false);
+            while (!stop.load(std::memory_order_relaxed)) {
+                int i = pick(rng);
+                if (present[i]) {
+                    tree.remove(2 * i + 1);
+                } else {
+                    tree.insert(2 * i + 1, i);
+                }
+                present[i] = !present[i];
+            }
+            // leave the tree as it was for the next run
+            for (int i = 0; i < keys / 2; ++i) {
+                if (present[i]) {
+                    tree.remove(2 * i + 1);
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    long long total = 0;
+    for (long long count : done) {
+        total += count;
+    }
+    return total / seconds;
+}
+
+// the whole sweep on one kind of tree
+template <class TREE>
+static void sweep(int keys, double seconds, int max_threads, bool writer) {
+    std::remove("bptree_bench.db");
+    std::remove("bptree_bench.wal");
+    {
+        // the whole tree fits in the pool, so we measure latching and not the disk
+        wal_options options;
+        options.enabled = false;
+        TREE tree("bptree_bench", keys / TREE::LEAF_CAPACITY * 2 + 1024, options);
+        std::vector<std::pair<int, int>> records;
+        for (int k = 0; k < keys; k += 2) {
+            records.emplace_back(k, k);
+        }
+        tree.bulk_load(records.begin(), records.end(), 0.7);
+
+        std::printf("%8s %14s %8s\n", "readers", "lookups/s", "speedup");
+        double base = 0;
+        for (int readers = 1; readers <= max_threads; readers *= 2) {
+            double rate = run(tree, keys, seconds, readers, writer);
+            if (readers == 1) {
+                base = rate;
+            }
+            std::printf("%8d %14.0f %7.2fx\n", readers, rate, rate / base);
+        }
+    }
+    std::remove("bptree_bench.db");
+}
+
+int main(int argc, char *argv[]) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+    int max_threads = argc > 3 ? std::atoi(argv[3])
+                               : std::max(1, int(std::thread::hardware_concurrency()));
+    bool writer = argc > 4 && std::atoi(argv[4]) != 0;
+    bool optimistic = argc > 5 && std::string(argv[5]) == "optimistic";
+
+    std::printf("%d keys, %.1fs per run, %s, %s\n", keys / 2, seconds,
+                writer ? "one writer" : "no writer",
+                optimistic ? "optimistic latching" : "latch crabbing");
+    if (optimistic) {
+        sweep<optimistic_tree>(keys, seconds, max_threads, writer);
+    } else {
+        sweep<crabbing_tree>(keys, seconds, max_threads, writer);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*!
+ * @file bloom_filter.h
+ * @author Luminolt
+ * @brief small Bloom filter over keys, for lookups of keys that are not there
+ */
+
+#ifndef INCLUDE_BLOOM_FILTER_H_
+#define INCLUDE_BLOOM_FILTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "node_search.h"
+
+/*!
+ * @brief bloom_filter class
+ * @brief a set of key hashes that may answer "maybe" for a key never added
+ *      - bits are only ever set, so add() and may_contain() may run at the
+ *        same time, a reader sees a key once its add() happened before
+ *      - nothing can be taken out, a removed key stays "maybe"
+ */
+class bloom_filter {
+public:
+    // bits is rounded up to whole words, hashes probes per key
+    bloom_filter(std::size_t bits, int hashes) : words_((bits + 63) / 64), hashes_(hashes) {}
+
+    bloom_filter(const bloom_filter &) = delete;
+    bloom_filter &operator=(const bloom_filter &) = delete;
+
+    void add(uint64_t hash) {
+        // double hashing, the high half steps through the probes
+        uint64_t step = (hash >> 32) | 1;
+        for (int i = 0; i < hashes_; ++i, hash += step) {
+            std::size_t bit = hash % (words_.size() * 64);
+            words_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+    }
+
+    bool may_contain(uint64_t hash) const {
+        uint64_t step = (hash >> 32) | 1;
+        for (int i = 0; i < hashes_; ++i, hash += step) {
+            std::size_t bit = hash % (words_.size() * 64);
+            if (!(words_[bit / 64].load(std::memory_order_relaxed) >> (bit % 64) & 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // probes that give the fewest false positives at bits_per_key (about ln 2 of it)
+    static int best_hashes(int bits_per_key) {
+        return std::max(1, std::min(16, bits_per_key * 69 / 100));
+    }
+
+    // hash of a key, int-backed keys by their int
+    template <class KT>
+    static uint64_t key_hash(const KT &key) {
+        uint64_t hash;
+        if constexpr (int_key<KT>::value) {
+            int raw;
+            std::memcpy(&raw, &key, sizeof(raw));
+            hash = uint32_t(raw);
+        } else {
+            hash = std::hash<KT>()(key);
+        }
+        // splitmix64 finalizer, std::hash of an int is the int
+        hash += 0x9e3779b97f4a7c15ULL;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+    }
+
+protected:
+    std::vector<std::atomic<uint64_t>> words_;
+    int hashes_;
+};
+
+#endif  // INCLUDE_BLOOM_FILTER_H_
@@ -7,112 +7,191 @@
 #ifndef INCLUDE_BPNODE_H_
 #define INCLUDE_BPNODE_H_
 
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <variant>
-#include <vector>
 
-// we use page_id to identify a node, rather than a pointer
-typedef int page_id_t;
+#include "inline_array.h"
+#include "node_search.h"
+#include "page_codec.h"
+#include "page_store.h"
+
+// kind of a page, the first byte of each page
+enum PAGE_KIND : uint8_t { free_page, internal_page, leaf_page };
 
 /*!
  * @brief template clss for bp node
  * @tparam KT key type
  * @tparam VT value type
- * @tparam ORDER order of b+tree
+ * @tparam PAGE_SIZE size of the page a node is stored in
+ * @tparam PREFIX_KEYS store leaf keys as deltas from the first key (int-backed keys only)
+ * @tparam COUNTS internal nodes also keep the number of records under each child
  * @brief B+Tree Node
  *      - A node can be either an internal node or a leaf node
  *      - Internal nodes have keys and pointers to child nodes
  *      - Leaf nodes have keys and values
+ *      - The capacities are the most keys that still fit in one page
+ *      - With PREFIX_KEYS a leaf page keeps its first key and then 1, 2 or 4 byte
+ *        deltas, whichever holds the widest one, so a leaf of close keys holds more
  */
-template <class KT, class VT, std::size_t ORDER>
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS = false, bool COUNTS = false>
 class bpnode {
 public:
+    static_assert(!PREFIX_KEYS || int_key<KT>::value, "bpnode: prefix keys need int-backed keys");
+
+    // kind, key_num_, prev_page_ and next_page_
+    static constexpr std::size_t HEADER_SIZE =
+        sizeof(uint8_t) + sizeof(int) + 2 * sizeof(page_id_t);
+
+    // delta width and the first key, before the deltas of a prefixed leaf
+    static constexpr std::size_t PREFIX_HEADER_SIZE = PREFIX_KEYS ? 1 + sizeof(KT) : 0;
+
+    // with PREFIX_KEYS this is the best case of 1 byte deltas, see leaf_limit()
+    static constexpr int LEAF_CAPACITY =
+        (PAGE_SIZE - HEADER_SIZE - PREFIX_HEADER_SIZE) /
+        ((PREFIX_KEYS ? 1 : record_size<KT>()) + record_size<VT>());
+    // a child takes its page id, and its record count with COUNTS
+    static constexpr std::size_t CHILD_SIZE = sizeof(page_id_t) + (COUNTS ? sizeof(int) : 0);
+    static constexpr int INTERNAL_CAPACITY =
+        (PAGE_SIZE - HEADER_SIZE - CHILD_SIZE) / (record_size<KT>() + CHILD_SIZE);
+
+    static_assert(PAGE_SIZE > HEADER_SIZE && LEAF_CAPACITY >= 3 && INTERNAL_CAPACITY >= 3,
+                  "bpnode: page is too small for the key/value types");
+
+    // one spare slot, a node overflows by one key before it splits
+    static constexpr std::size_t KEY_SLOTS = std::max(LEAF_CAPACITY, INTERNAL_CAPACITY) + 1;
+
     page_id_t page_id_;
     bool is_leaf_;
     int key_num_;
-    std::vector<KT> keys_;
-    std::vector<VT> values_;  // In case of same type, we don't use variant
-    std::vector<page_id_t> sub_ptrs_;
-    int parent_page_;
+    inline_array<KT, KEY_SLOTS> keys_;
+    inline_array<VT, LEAF_CAPACITY + 1> values_;  // In case of same type, we don't use variant
+    inline_array<page_id_t, INTERNAL_CAPACITY + 2> sub_ptrs_;
+    inline_array<int, COUNTS ? INTERNAL_CAPACITY + 2 : 1> counts_;  // records under sub_ptrs_
     int prev_page_;  // for leafs
     int next_page_;  // for leafs
-    std::string folder_name_;
-
-    // constructor
-    explicit bpnode(page_id_t, std::string);
+    int last_insert_;  // where the last key went in, -1 if not known (don't save in file)
 
-    // destructor
-    ~bpnode();
+    // constructor, an empty node of the page
+    // (nodes are loaded and written back by the buffer pool)
+    explicit bpnode(page_id_t);
 
     // override [] operator
     VT &operator[](KT);
 
-    // override iostream
-    std::istream &input(std::istream &is);
-    std::ostream &output(std::ostream &os);
+    // most keys a leaf can hold when its keys go from first to last
+    static int leaf_limit(const KT &first, const KT &last);
+
+    // too many keys for the page, it has to split
+    bool overflow() const;
+
+    // "safe" nodes: one more key (key, for a leaf) does not split it, one key less
+    // does not empty it. The nodes above a safe node are not touched.
+    bool insert_safe(const KT &key) const;
+    bool remove_safe() const { return key_num_ > 1; }
+
+    // records under this node, with COUNTS
+    int record_count() const {
+        if (is_leaf_) {
+            return key_num_;
+        }
+        int count = 0;
+        for (int i = 0; i <= key_num_; ++i) {
+            count += counts_[i];
+        }
+        return count;
+    }
+
+    // first key >= key / > key, as an index (SIMD for int-backed keys)
+    int lower_bound(const KT &key) const { return node_lower_bound(keys_.data(), key_num_, key); }
+    int upper_bound(const KT &key) const { return node_upper_bound(keys_.data(), key_num_, key); }
+
+    // page (de)serialization
+    void serialize(char *buf);
+    void deserialize(const char *buf);
 
     // for my debug
     std::istream &debug_input(std::istream &is);
     std::ostream &debug_output(std::ostream &os);
 
-    friend std::istream &operator>>(std::istream &is, bpnode<KT, VT, ORDER> &self) {
+    friend std::istream &operator>>(std::istream &is, bpnode &self) {
         return self.debug_input(is);
     }
 
-    friend std::ostream &operator<<(std::ostream &os, bpnode<KT, VT, ORDER> &self) {
+    friend std::ostream &operator<<(std::ostream &os, bpnode &self) {
         return self.debug_output(os);
     }
+
+protected:
+    // int-backed keys as ints and back
+    static int raw_key(const KT &key) {
+        int raw;
+        std::memcpy(&raw, &key, sizeof(raw));
+        return raw;
+    }
+    static KT make_key(int raw) {
+        KT key;
+        std::memcpy(static_cast<void *>(&key), &raw, sizeof(raw));
+        return key;
+    }
+
+    // bytes per delta, for keys from first to last
+    static int delta_width(const KT &first, const KT &last) {
+        uint32_t span = uint32_t(raw_key(last)) - uint32_t(raw_key(first));
+        return span <= UINT8_MAX ? 1 : (span <= UINT16_MAX ? 2 : 4);
+    }
+
+    // leaf keys of a PREFIX_KEYS page
+    void put_prefix_keys(page_writer &writer);
+    void get_prefix_keys(page_reader &reader);
 };
 
-template <class KT, class VT, std::size_t ORDER>
-bpnode<KT, VT, ORDER>::bpnode(page_id_t page_id, std::string folder_name) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+int bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::leaf_limit(const KT &first, const KT &last) {
+    if constexpr (PREFIX_KEYS) {
+        return (PAGE_SIZE - HEADER_SIZE - PREFIX_HEADER_SIZE) /
+               (delta_width(first, last) + record_size<VT>());
+    } else {
+        return LEAF_CAPACITY;
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+bool bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::overflow() const {
+    if (!is_leaf_) {
+        return key_num_ > INTERNAL_CAPACITY;
+    }
+    return key_num_ > 0 && key_num_ > leaf_limit(keys_.front(), keys_.back());
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+bool bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::insert_safe(const KT &key) const {
+    if (!is_leaf_) {
+        return key_num_ < INTERNAL_CAPACITY;
+    }
+    if (key_num_ == 0) {
+        return true;
+    }
+    return key_num_ < leaf_limit(std::min(keys_.front(), key), std::max(keys_.back(), key));
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::bpnode(page_id_t page_id) {
     page_id_ = page_id;  // don't save in file
-    folder_name_ = folder_name;
     is_leaf_ = false;
     key_num_ = 0;
     prev_page_ = -1;
     next_page_ = -1;
-    parent_page_ = -1;
-    auto file_name = folder_name_ + "/" + std::to_string(page_id) + ".txt";
-    std::ifstream file(file_name);
-    if (!file.is_open()) {
-        // throw std::runtime_error("file is not open!");
-        // init an empty node
-        return;
-    }
-    file >> *this;
-    file.close();
-}
-
-template <class KT, class VT, std::size_t ORDER>
-bpnode<KT, VT, ORDER>::~bpnode() {
-    if (key_num_ > 0) {
-        auto file_name = folder_name_ + "/" + std::to_string(page_id_) + ".txt";
-        std::ofstream file(file_name);
-        file << *this;
-        file.close();
-    } else {
-        if (prev_page_ != -1) {
-            bpnode<KT, VT, ORDER> prev_node = bpnode<KT, VT, ORDER>(prev_page_, folder_name_);
-            prev_node.next_page_ = next_page_;
-        }
-        if (next_page_ != -1) {
-            bpnode<KT, VT, ORDER> next_node = bpnode<KT, VT, ORDER>(next_page_, folder_name_);
-            next_node.prev_page_ = prev_page_;
-        }
-        auto file_name = folder_name_ + "/" + std::to_string(page_id_) + ".txt";
-        std::remove(file_name.c_str());
-    }
+    last_insert_ = -1;
 }
 
-template <class KT, class VT, std::size_t ORDER>
-VT &bpnode<KT, VT, ORDER>::operator[](KT key) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+VT &bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::operator[](KT key) {
     if (!is_leaf_) {
         throw std::runtime_error("op[]: this is not a leaf node!");
     }
-    auto real_idx = std::lower_bound(keys_.begin(), keys_.end(), key);
+    auto real_idx = keys_.begin() + lower_bound(key);
     if (real_idx == keys_.end()) {
         throw std::runtime_error("op[]: key not found!");
         // only for debug use, this should never happen!
@@ -120,36 +199,48 @@ VT &bpnode<KT, VT, ORDER>::operator[](KT key) {
     return values_[real_idx - keys_.begin()];
 }
 
-template <class KT, class VT, std::size_t ORDER>
-std::istream &bpnode<KT, VT, ORDER>::input(std::istream &is) {
-    is >> is_leaf_;
-    is >> key_num_;
-    for (int i = 0; i < key_num_; ++i) {
-        KT key;
-        is >> key;
-        keys_.emplace_back(key);
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+void bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::deserialize(const char *buf) {
+    page_reader reader(buf, PAGE_SIZE);
+    uint8_t kind;
+    reader.get(kind);
+    if (kind == free_page) {
+        // init an empty node
+        return;
     }
-    is >> parent_page_;
-    is >> prev_page_;
-    is >> next_page_;
-    if (is_leaf_) {
-        for (int i = 0; i < key_num_; ++i) {
-            VT sub_ptr;
-            is >> sub_ptr;
-            values_.emplace_back(sub_ptr);
+    is_leaf_ = (kind == leaf_page);
+    reader.get(key_num_);
+    if (key_num_ < 0 || key_num_ > (is_leaf_ ? LEAF_CAPACITY : INTERNAL_CAPACITY)) {
+        throw std::runtime_error("bpnode: broken page");
+    }
+    reader.get(prev_page_);
+    reader.get(next_page_);
+    if constexpr (PREFIX_KEYS) {
+        if (is_leaf_) {
+            get_prefix_keys(reader);
+        } else {
+            keys_.resize(key_num_);
+            reader.get_array(keys_.data(), key_num_);
         }
     } else {
-        for (int i = 0; i < key_num_ + 1; ++i) {
-            page_id_t sub_ptr;
-            is >> sub_ptr;
-            sub_ptrs_.emplace_back(sub_ptr);
+        keys_.resize(key_num_);
+        reader.get_array(keys_.data(), key_num_);
+    }
+    if (is_leaf_) {
+        values_.resize(key_num_);
+        reader.get_array(values_.data(), key_num_);
+    } else {
+        sub_ptrs_.resize(key_num_ + 1);
+        reader.get_array(sub_ptrs_.data(), key_num_ + 1);
+        if constexpr (COUNTS) {
+            counts_.resize(key_num_ + 1);
+            reader.get_array(counts_.data(), key_num_ + 1);
         }
     }
-    return is;
 }
 
-template <class KT, class VT, std::size_t ORDER>
-std::istream &bpnode<KT, VT, ORDER>::debug_input(std::istream &is) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+std::istream &bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::debug_input(std::istream &is) {
     std::string tmp;
     is >> tmp >> is_leaf_;
     is >> tmp >> key_num_;
@@ -158,7 +249,6 @@ std::istream &bpnode<KT, VT, ORDER>::debug_input(std::istream &is) {
         is >> key;
         keys_.emplace_back(key);
     }
-    is >> tmp >> parent_page_;
     is >> tmp >> prev_page_;
     is >> tmp >> next_page_;
     is >> tmp;
@@ -178,36 +268,93 @@ std::istream &bpnode<KT, VT, ORDER>::debug_input(std::istream &is) {
     return is;
 }
 
-template <class KT, class VT, std::size_t ORDER>
-std::ostream &bpnode<KT, VT, ORDER>::output(std::ostream &os) {
-    os << is_leaf_ << std::endl;
-    os << key_num_ << std::endl;
-    for (int i = 0; i < key_num_; ++i) {
-        os << keys_[i] << std::endl;
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+void bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::serialize(char *buf) {
+    page_writer writer(buf, PAGE_SIZE);
+    uint8_t kind = is_leaf_ ? leaf_page : internal_page;
+    writer.put(kind);
+    writer.put(key_num_);
+    writer.put(prev_page_);
+    writer.put(next_page_);
+    if constexpr (PREFIX_KEYS) {
+        if (is_leaf_) {
+            put_prefix_keys(writer);
+        } else {
+            writer.put_array(keys_.data(), key_num_);
+        }
+    } else {
+        writer.put_array(keys_.data(), key_num_);
     }
-    os << parent_page_ << std::endl;
-    os << prev_page_ << std::endl;
-    os << next_page_ << std::endl;
     if (is_leaf_) {
-        for (int i = 0; i < key_num_; ++i) {
-            os << values_[i] << std::endl;
-        }
+        writer.put_array(values_.data(), key_num_);
     } else {
-        for (int i = 0; i < key_num_ + 1; ++i) {
-            os << sub_ptrs_[i] << std::endl;
+        writer.put_array(sub_ptrs_.data(), key_num_ + 1);
+        if constexpr (COUNTS) {
+            writer.put_array(counts_.data(), key_num_ + 1);
         }
     }
-    return os;
+    // keep the tail of the page clean
+    std::memset(buf + writer.pos(), 0, PAGE_SIZE - writer.pos());
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+void bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::put_prefix_keys(page_writer &writer) {
+    if (key_num_ == 0) {
+        return;
+    }
+    uint8_t width = delta_width(keys_.front(), keys_[key_num_ - 1]);
+    uint32_t base = raw_key(keys_.front());
+    writer.put(width);
+    writer.put(keys_.front());
+    for (int i = 0; i < key_num_; ++i) {
+        uint32_t delta = uint32_t(raw_key(keys_[i])) - base;
+        if (width == 1) {
+            writer.put(uint8_t(delta));
+        } else if (width == 2) {
+            writer.put(uint16_t(delta));
+        } else {
+            writer.put(delta);
+        }
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+void bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::get_prefix_keys(page_reader &reader) {
+    keys_.resize(key_num_);
+    if (key_num_ == 0) {
+        return;
+    }
+    uint8_t width;
+    KT first;
+    reader.get(width);
+    reader.get(first);
+    uint32_t base = raw_key(first);
+    for (int i = 0; i < key_num_; ++i) {
+        uint32_t delta;
+        if (width == 1) {
+            uint8_t d;
+            reader.get(d);
+            delta = d;
+        } else if (width == 2) {
+            uint16_t d;
+            reader.get(d);
+            delta = d;
+        } else if (width == 4) {
+            reader.get(delta);
+        } else {
+            throw std::runtime_error("bpnode: broken page");
+        }
+        keys_[i] = make_key(base + delta);
+    }
 }
 
-template <class KT, class VT, std::size_t ORDER>
-std::ostream &bpnode<KT, VT, ORDER>::debug_output(std::ostream &os) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, bool COUNTS>
+std::ostream &bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::debug_output(std::ostream &os) {
     os << "is_leaf_: " << is_leaf_ << std::endl;
     os << "key_num_: " << key_num_ << std::endl;
     for (int i = 0; i < key_num_; ++i) {
         os << keys_[i] << std::endl;
     }
-    os << "parent_page_: " << parent_page_ << std::endl;
     os << "prev_page_: " << prev_page_ << std::endl;
     os << "next_page_: " << next_page_ << std::endl;
     os << "values_or_sub_ptrs: " << std::endl;
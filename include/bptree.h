@@ -7,200 +7,2030 @@
 #ifndef INCLUDE_BPTREE_H_
 #define INCLUDE_BPTREE_H_
 
-#include <sys/stat.h>
-
 #include <algorithm>
-#include <cmath>
+#include <condition_variable>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
+#include "bloom_filter.h"
 #include "bpnode.h"
+#include "buffer_pool.h"
+#include "wal.h"
+
+// default capacity of the buffer pool, in pages
+constexpr std::size_t DEFAULT_POOL_SIZE = 1024;
+
+// How a bptree shares its nodes between threads, the LATCHING parameter.
+// latch_crabbing: readers and writers latch their way down, see bptree.
+struct latch_crabbing {};
+// optimistic_latching: internal nodes are read without a latch and checked
+// against their latch version afterwards, going down again if a writer was
+// there. Only leaves are latched on the way down, and writers latch just the
+// nodes they change, from the leaf up, without waiting.
+struct optimistic_latching {};
 
 /*!
  * @brief template clss for bp tree
  * @tparam KT key type
  * @tparam VT value type
- * @tparam ORDER order of b+tree
+ * @tparam PAGE_SIZE size of a page on disk, the fanout is derived from it
+ * @tparam PREFIX_KEYS prefix-compress leaf keys on disk, for int-backed keys (see bpnode)
+ * @tparam LATCHING latch_crabbing or optimistic_latching, see above
+ * @tparam COUNTS keep record counts in internal nodes, for count / rank / select
  * @brief B+Tree Node
  *      - an on-file b+tree
- *      - methods including insert, remove and search(with edit)
+ *      - nodes are cached in a buffer pool and written back lazily
+ *      - with the write-ahead log (<name>.wal, on by default) each mutation is
+ *        logged as a logical redo record, and dirty nodes reach <name>.db only
+ *        at a checkpoint, which goes through the log first. Opening the tree
+ *        replays the log on the last checkpoint.
+ *      - safe to share between threads. Each node has a reader/writer latch and
+ *        we use latch crabbing: readers go down holding at most a parent and a child,
+ *        writers latch exclusively and let the nodes above go once a node is
+ *        safe (it won't split or go empty). Most writes only latch their leaf
+ *        exclusively. Leaves are always latched left to right. With
+ *        optimistic_latching readers never wait on internal nodes, and a split
+ *        only holds the nodes it changes.
+ *        Callbacks run under the leaf latch, they must not write this tree.
+ *      - methods including insert, remove and search(with edit), and find /
+ *        contains / update for lookups that may miss, without exceptions
+ *      - with COUNTS, count / rank / select in O(log n). Every insert and remove
+ *        changes the counts up to the root, so writers then latch the whole way
+ *        down and go one at a time, readers are not slowed down.
+ *      - take_snapshot() for long reads of one moment while writers go on,
+ *        see the snapshot class
  */
-template <class KT, class VT, std::size_t ORDER>
+template <class KT, class VT, std::size_t PAGE_SIZE = DEFAULT_PAGE_SIZE, bool PREFIX_KEYS = false,
+          class LATCHING = latch_crabbing, bool COUNTS = false>
 class bptree {
 public:
-    // Default Constructor
-    bptree(std::string);
+    // Most keys in a leaf / internal node, as many as fit in a page
+    static constexpr int LEAF_CAPACITY =
+        bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::LEAF_CAPACITY;
+    static constexpr int INTERNAL_CAPACITY =
+        bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS>::INTERNAL_CAPACITY;
+
+    // Default Constructor, the tree is stored in <name>.db
+    bptree(std::string, std::size_t pool_size = DEFAULT_POOL_SIZE,
+           wal_options options = wal_options());
+
+    // Destructor
+    ~bptree();
+
+    // Insert <key,value> to the B+ tree
+    void insert(KT key, VT value);
+
+    // Insert many <key,value>, sorted first so that we go down once per
+    // leaf touched and split each leaf at most once
+    void insert_batch(std::vector<std::pair<KT, VT>> records);
+
+    // Remove <key> in the B+ tree
+    void remove(KT key);
+
+    // Build the tree bottom-up from <key,value> pairs sorted by key,
+    // leaves are filled to fill_factor and each page is written once.
+    // The tree must be empty.
+    template <class IT>
+    void bulk_load(IT first, IT last, double fill_factor = 1.0);
+
+    // Same as above, the records are sorted first
+    void bulk_load(std::vector<std::pair<KT, VT>> records, double fill_factor = 1.0);
+
+    // Whether the tree has no key
+    bool empty() const {
+        std::shared_lock<rw_latch> root_lock(root_latch_);
+        return root_ == -1;
+    }
+
+    // Search <key> in the B+ tree and call the function
+    void search(KT key, std::function<void(VT &)> func, int mode = 0) {
+        range_search(key, key, func, mode);
+    }
+
+    // Search <st~ed> in the B+ tree and call the function
+    void search(KT st, KT ed, std::function<void(VT &)> func, int mode = 0) {
+        range_search(st, ed, func, mode);
+    }
+
+    // Read-only search <key>, never writes any page back
+    void read(KT key, std::function<void(const VT &)> func, int mode = 0) {
+        range_read(key, key, func, mode);
+    }
+
+    // Read-only search <st~ed>, never writes any page back
+    void read(KT st, KT ed, std::function<void(const VT &)> func, int mode = 0) {
+        range_read(st, ed, func, mode);
+    }
+
+    // Visitor versions of the above, the callback is inlined
+    // and a callback returning false stops the walk
+    template <class FUNC>
+    void search(KT key, FUNC &&func) {
+        range_search(key, key, func, 0);
+    }
+    template <class FUNC>
+    void search(KT st, KT ed, FUNC &&func) {
+        range_search(st, ed, func, 0);
+    }
+    template <class FUNC>
+    void read(KT key, FUNC &&func) {
+        range_read(key, key, func, 0);
+    }
+    template <class FUNC>
+    void read(KT st, KT ed, FUNC &&func) {
+        range_read(st, ed, func, 0);
+    }
+
+    // Point lookups that tell a miss instead of throwing: a copy of the value
+    // of <key>, or whether it is there
+    std::optional<VT> find(KT key);
+    bool contains(KT key);
+
+    // Edit the value of <key> in place like search(), false (and func is not
+    // called) if it is not there
+    template <class FUNC>
+    bool update(KT key, FUNC &&func);
+
+    // Look many keys up at once: they are sorted and deduplicated, and each leaf
+    // they touch is reached with one descent and latched once. The values line
+    // up with keys, empty for a miss.
+    std::vector<std::optional<VT>> multi_get(const std::vector<KT> &keys);
+
+    // update() on many keys at once, in key order and once per key, a callback
+    // returning false stops it. Returns how many keys were there.
+    template <class FUNC>
+    std::size_t multi_update(std::vector<KT> keys, FUNC &&func);
+
+    // Read <st~ed> on up to threads threads (0 for one per core). The range is
+    // cut at separators near the root into parts of about as many leaves, and
+    // each part folds its records into a T of its own, fold(part, key, value),
+    // in key order. merge(result, std::move(part)) runs on the calling thread
+    // as parts are done, in key order if ordered, else as they come.
+    template <class T, class FOLD, class MERGE>
+    T parallel_scan(KT st, KT ed, FOLD &&fold, MERGE &&merge, bool ordered = true,
+                    unsigned threads = 0);
+
+    // Keep a Bloom filter of bits_per_key bits per key for each leaf, in memory.
+    // A lookup that reaches a leaf builds its filter, and the lookups after it
+    // stop at the parent for most keys that are not there. 0 drops them.
+    void set_leaf_filters(int bits_per_key = 10);
+
+    // Range scans that go past a leaf have the buffer pool read the next <leaves>
+    // leaves on a helper thread meanwhile. 0 (the default) turns it off.
+    void set_readahead(int leaves) {
+        if (leaves < 0) {
+            throw std::invalid_argument("set_readahead: leaves should not be negative");
+        }
+        readahead_ = leaves;
+    }
+
+    // Cursor on the leaf chain, it keeps its leaf pinned
+    class cursor;
+
+    // Cursor on the first / last key, or the first key >= key
+    cursor first();
+    cursor last();
+    cursor lower_bound(KT key);
+
+    // With COUNTS: number of records, of records in <st~ed>, of records < key,
+    // and a cursor on the k-th record from 0 (end() if there are not that many)
+    std::size_t size();
+    std::size_t count(KT st, KT ed);
+    std::size_t rank(KT key);
+    cursor select(std::size_t k);
+
+    // Read-only view of the tree as it is now, for long reads while writers go
+    // on. A node about to change is copied first while an open snapshot may
+    // still read it, and the copies go when the last such snapshot does.
+    class snapshot;
+    snapshot take_snapshot();
+
+    // Write all cached nodes and the meta page back, a checkpoint if logging
+    void flush();
+
+    // Rewrite the tree into the first pages of the file, leaves in key order
+    // and filled to fill_factor, and give the rest of the file back. Writers
+    // wait meanwhile. Readers and cursors go on in the old tree until the new
+    // one, built in free pages, is published through the meta page, so a crash
+    // leaves one or the other. All records are held in memory.
+    void compact(double fill_factor = 1.0);
+
+    // Wait until every mutation so far is in the log on disk
+    void sync() {
+        if (wal_) {
+            wal_->commit(wal_->last_lsn(), true);
+        }
+    }
+
+protected:
+    typedef bpnode<KT, VT, PAGE_SIZE, PREFIX_KEYS, COUNTS> node_t;
+    typedef typename buffer_pool<node_t>::handle node_handle;
+
+    page_id_t root_;            // Root of the B+VTree
+    page_store store_;          // Data file of the B+VTree
+    buffer_pool<node_t> pool_;  // Cached nodes of the B+VTree
+    int page_id_counter_;       // Counter of the page id.
+    page_id_t saved_root_;      // root_, page_id_counter_ and the free list head in the meta page
+    int saved_page_id_counter_;
+    page_id_t saved_free_head_;
+
+    mutable rw_latch root_latch_;      // guards root_, the parent of the root when crabbing
+    std::shared_mutex tree_latch_;     // shared by writers, exclusive for whole-tree work
+    std::mutex page_mutex_;            // guards page_id_counter_, free_pages_ and pending_free_
+
+    std::unique_ptr<wal> wal_;            // Log of the B+VTree, null if not logging
+    wal_options wal_options_;
+    std::size_t checkpoint_pages_;        // checkpoint at this many dirty pages
+    bool replaying_;                      // don't log what we replay
+    std::vector<page_id_t> pending_free_;  // freed since the last checkpoint
+
+    // Free pages to reuse before growing the file, the last one is the head.
+    // On disk each links to the one before it, and the head is in the meta page.
+    std::vector<page_id_t> free_pages_;
+
+    // Bloom filters of leaves by page id, see set_leaf_filters(). A filter has
+    // every key of its leaf: keys moving into a leaf are added under its latch,
+    // and a freed page loses its filter. Leaves without one are just read.
+    std::unordered_map<page_id_t, std::unique_ptr<bloom_filter>> filters_;
+    mutable std::shared_mutex filter_mutex_;  // guards filters_
+    std::atomic<int> filter_bits_;            // bits per key, 0 if off
+
+    std::atomic<int> readahead_;  // leaves, see set_readahead()
+
+    // Old versions of nodes kept for snapshots, by page id. Each snapshot takes
+    // the next epoch, and a node changing while snapshots are open is copied
+    // first, once per newest open epoch, tagged with it. A snapshot reads a page
+    // as its first version tagged >= its epoch, or as the live node if none is.
+    typedef std::vector<std::pair<uint64_t, std::shared_ptr<const node_t>>> version_list;
+    std::unordered_map<page_id_t, version_list> versions_;
+    std::set<uint64_t> snapshots_;           // epochs of the open snapshots
+    uint64_t epoch_;                         // of the last snapshot taken
+    std::atomic<uint64_t> latest_snapshot_;  // newest open epoch, 0 if none
+    std::mutex version_mutex_;               // guards the members above
+
+    // meta page (page 0) layout: magic, root_, page_id_counter_, page size, PREFIX_KEYS,
+    // head of the free list (0 for none, page 0 is the meta page), COUNTS, and
+    // whether values have a binary layout (see binary_record)
+    static constexpr uint32_t META_MAGIC = 0x31545042;  // "BPT1"
+
+    // what a writer going down may do to the nodes on its way
+    enum WRITE_KIND { write_insert, write_remove, write_batch };
+
+    // Where a full node is cut: in the middle, or right at the new key if it went
+    // in at the far end of the last (first) node of a level, or right after the
+    // key that went into the leaf before it. Keys coming in order, into the whole
+    // tree or one range of it, then leave full nodes behind them instead of half
+    // empty ones.
+    enum SPLIT_KIND { split_half, split_append, split_prepend };
+
+    static constexpr bool OPTIMISTIC = std::is_same<LATCHING, optimistic_latching>::value;
+    static_assert(!OPTIMISTIC || std::is_trivially_copyable<KT>::value,
+                  "optimistic_latching reads keys while they may change");
+
+    // an internal node read optimistically on the way down, pinned but not latched
+    struct seen_node {
+        node_handle node;
+        uint32_t version;
+    };
+
+    // Go down to the leaf of <key>, internal nodes are latched shared (or only
+    // read, if optimistic) and the leaf in mode. Empty handle if the tree is empty.
+    // If filtered, also an empty handle when the leaf filter says <key> is not there.
+    node_handle find_leaf(KT key, LATCH_MODE mode, bool filtered = false) {
+        return find_leaf_by([&](const node_t &node) { return node.upper_bound(key); }, mode,
+                            filtered ? &key : nullptr);
+    }
+
+    // Same as above, choose(node) picks the child to go to, and the leaf
+    // filter is asked about probe if given
+    template <class CHOOSE>
+    node_handle find_leaf_by(CHOOSE &&choose, LATCH_MODE mode, const KT *probe = nullptr);
+
+    // One optimistic way down, false if a writer got in the way (nothing is held
+    // then, try again). seen (if given) gets the internal nodes passed, root first,
+    // and root_version the version of root_latch_.
+    template <class CHOOSE>
+    bool try_find_leaf(CHOOSE &choose, LATCH_MODE mode, node_handle &leaf,
+                       uint32_t &root_version, std::vector<seen_node> *seen,
+                       const KT *probe = nullptr);
+
+    // Whether key may be in the leaf at page_id, true if it has no filter
+    bool filter_may_contain(page_id_t page_id, const KT &key) const {
+        if (filter_bits_.load(std::memory_order_relaxed) == 0) {
+            return true;
+        }
+        std::shared_lock<std::shared_mutex> lock(filter_mutex_);
+        auto it = filters_.find(page_id);
+        return it == filters_.end() || it->second->may_contain(bloom_filter::key_hash(key));
+    }
+
+    // key moved into a leaf, which is latched exclusively
+    void filter_add(const node_handle &leaf, const KT &key) {
+        if (filter_bits_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        std::shared_lock<std::shared_mutex> lock(filter_mutex_);
+        auto it = filters_.find(leaf.page_id());
+        if (it != filters_.end()) {
+            it->second->add(bloom_filter::key_hash(key));
+        }
+    }
+
+    // Give a latched leaf a filter if it has none
+    void filter_build(const node_handle &leaf);
+
+    // Go to <key> and call visit(leaf, pos) with its leaf latched in mode,
+    // false if it is not there
+    template <class VISIT>
+    bool lookup(KT key, LATCH_MODE mode, VISIT &&visit);
+
+    // Go through sorted distinct keys leaf by leaf, visit(leaf, pos, i) is called
+    // for each keys[i] there with its leaf latched in mode, until it returns false.
+    // One descent per leaf, which also tells up to where the leaf goes.
+    template <class VISIT>
+    std::size_t multi_walk(const std::vector<KT> &keys, LATCH_MODE mode, VISIT &&visit);
+
+    // Up to parts - 1 separators in (st, ed] from the top two levels, evenly
+    // spread, in key order
+    std::vector<KT> split_range(const KT &st, const KT &ed, std::size_t parts);
+
+    // A scan reached leaf and goes on past it: have the next leaves read now
+    // and then, ahead is how many of them were asked for and not reached yet
+    void read_ahead(const node_handle &leaf, int &ahead) {
+        int leaves = readahead_.load(std::memory_order_relaxed);
+        if (ahead > 0) {
+            ahead--;
+        }
+        if (leaves > 0 && ahead <= leaves / 2 && leaf->next_page_ != -1) {
+            pool_.read_ahead(leaf->next_page_, leaves);
+            ahead = leaves;
+        }
+    }
+
+    // Walk the leaves from key_start on, latched shared, visit(leaf, pos) is
+    // called on each record until it returns false
+    template <class VISIT>
+    void walk_from(const KT &key_start, VISIT &&visit);
+
+    // A node as a snapshot sees it: a kept version, or the live node latched shared
+    struct node_view {
+        std::shared_ptr<const node_t> kept;
+        node_handle live;
+
+        const node_t &operator*() const { return kept ? *kept : *live; }
+        const node_t *operator->() const { return &**this; }
+        explicit operator bool() const { return kept || live; }
+    };
+
+    // Page page_id as the snapshot of epoch sees it
+    node_view view_node(page_id_t page_id, uint64_t epoch);
+
+    // node is latched exclusively and about to change: keep its old version if
+    // a snapshot is open, and mark it dirty
+    void before_change(node_handle &node) {
+        if (latest_snapshot_.load(std::memory_order_relaxed) != 0) {
+            keep_version(node);
+        }
+        node.mark_dirty();
+    }
+
+    // Copy a latched node for the open snapshots, unless the newest one has it
+    void keep_version(const node_handle &node);
+
+    // A snapshot is let go, drop the versions no open snapshot reads
+    void release_snapshot(uint64_t epoch);
+
+    // parallel_scan() on walk(start, visit), which calls visit(leaf, pos) on
+    // each record from start on until it returns false
+    template <class T, class FOLD, class MERGE, class WALK>
+    T scan_parts(KT st, KT ed, FOLD &fold, MERGE &merge, bool ordered, unsigned threads,
+                 WALK &&walk);
+
+    // Whether a write of kind leaves the nodes above node as they are,
+    // never with COUNTS
+    static bool write_safe(const node_t &node, WRITE_KIND kind, const KT &key) {
+        if (COUNTS) {
+            return false;
+        }
+        if (kind == write_insert) {
+            return node.insert_safe(key);
+        }
+        return kind == write_remove && node.remove_safe();
+    }
+
+    // Latch the leaf of <key> exclusively for a write, and the nodes above it
+    // the write may change, as lock_path() does. Most of the time it is just the
+    // leaf. Empty handle if the tree is empty.
+    node_handle write_leaf(KT key, WRITE_KIND kind, std::vector<node_handle> &path,
+                           std::unique_lock<rw_latch> &root_lock);
+
+    // Go down to the leaf of <key> latching exclusively, for a write that may
+    // change the nodes above the leaf. path keeps the nodes it may change (from
+    // the lowest safe one, none are safe for a batch) and root_lock stays
+    // locked if root_ may change. Empty handle if the tree is empty.
+    node_handle lock_path(KT key, WRITE_KIND kind, std::vector<node_handle> &path,
+                          std::unique_lock<rw_latch> &root_lock,
+                          std::optional<KT> *fence = nullptr);
+
+    // Head of the free list, 0 if it is empty
+    page_id_t free_head() const { return free_pages_.empty() ? 0 : free_pages_.back(); }
+
+    // Page image of free_pages_[i]: the free_page kind, then the free page before it
+    void free_page_image(std::size_t i, char *buf) const;
+
+    // Load the free list from the data file, head first
+    void read_free_list(page_id_t head);
+
+    // Write the meta page if root_, page_id_counter_ or the free list head changed
+    void write_meta();
+
+    // Dirty nodes and the meta page go to the log, then to the data file,
+    // then the log is dropped. The caller holds tree_latch_ exclusively.
+    void checkpoint();
+
+    // Redo the log on open
+    void recover();
+
+    // Log a mutation, fields are written like page fields, returns its lsn
+    // (0 if not logged). Log under the latch of the leaf changed, so that
+    // records of a key are in the order they were applied.
+    template <class... T>
+    uint64_t log_record(WAL_KIND kind, const T &...fields) {
+        return append_record(encode_record(kind, fields...));
+    }
+
+    // The two halves of log_record. Encode before changing a node, so that a
+    // record that does not fit the page layout throws with the tree untouched,
+    // even if not logging (it would throw at the next flush), and append after.
+    template <class... T>
+    std::string encode_record(WAL_KIND kind, const T &...fields);
+    uint64_t append_record(const std::string &image) {
+        if (!wal_ || replaying_) {
+            return 0;
+        }
+        return wal_->append(image.data(), image.size());
+    }
+
+    // A mutation is done: commit it, and checkpoint if there are enough dirty nodes.
+    // Called with no latch held, maybe_checkpoint() with tree_latch_ held exclusively.
+    void end_op(uint64_t lsn);
+    void maybe_checkpoint();
+
+    // Insert / remove and log it, returns the lsn, tree_latch_ is held shared
+    uint64_t insert_one(KT key, VT value);
+    uint64_t remove_one(KT key);
+
+    // bulk_load, tree_latch_ is held exclusively
+    template <class IT>
+    void load_sorted(IT first, IT last, double fill_factor);
+
+    // Build the nodes of sorted records bottom-up, returns the root (-1 if none)
+    template <class IT>
+    page_id_t build_sorted(IT first, IT last, double fill_factor);
+
+    // compact(): make root the root with root_latch_ and then the old root
+    // latched exclusively, so that every descent is in the new tree or ahead of
+    // retire() in the old one. Returns the old root, still latched.
+    node_handle publish_root(page_id_t root);
+
+    // compact(): empty the leaves of an old tree from its latched root down,
+    // so that cursors on them seek again, and drop its pages from the pool
+    void retire(node_handle old_root);
+
+    // flush(), tree_latch_ is held exclusively
+    void flush_locked();
+
+    // Create a new node
+    node_handle new_node();
+
+    // Drop the page of an empty node, it is unlinked already
+    void free_node(node_handle &node);
+
+    // A page nothing points to joins the free list, page_mutex_ is held
+    void add_free_page(page_id_t page_id);
+
+    // Update the parent node after insert, path.back() is the parent,
+    // count records moved from the left child to the new one, kind is how
+    // the child was split
+    void insert_update_parent(std::vector<node_handle> &path, page_id_t new_page_id, KT key,
+                              int count, SPLIT_KIND kind = split_half);
+
+    // How a node that overflowed after a key went in at pos splits, edge is
+    // whether it is the last / first node of its level
+    static SPLIT_KIND split_kind(const node_t &node, int pos, SPLIT_KIND edge) {
+        if (edge == split_append && pos == node.key_num_ - 1) {
+            return split_append;
+        }
+        if (edge == split_prepend && pos == 0) {
+            return split_prepend;
+        }
+        return split_half;
+    }
+
+    // New root over two nodes, with count records under each
+    void grow_root(page_id_t left, page_id_t right, KT key, int left_count, int right_count);
+
+    // With COUNTS, delta records went in / out under path (all latched)
+    // on the way to <key>
+    void count_path(std::vector<node_handle> &path, const KT &key, int delta) {
+        if constexpr (COUNTS) {
+            for (node_handle &node : path) {
+                before_change(node);
+                node->counts_[node->upper_bound(key)] += delta;
+            }
+        }
+    }
+
+    // Records < key (<= key if inclusive), root_latch_ is held shared
+    std::size_t count_below(const KT &key, bool inclusive);
+
+    // Update the parent node after remove, path.back() is the parent of node
+    void remove_update_parent(node_handle &node, std::vector<node_handle> &path);
+
+    // Call a search callback on leaf->values_[pos], the leaf is latched
+    // exclusively. It is dirty and logged only if the value really changed.
+    // The callback edits a copy, which goes in once it is encoded.
+    template <class FUNC>
+    bool edit_value(node_handle &leaf, int pos, FUNC &func, bool &changed, uint64_t &lsn) {
+        VT &value = leaf->values_[pos];
+        if (latest_snapshot_.load(std::memory_order_relaxed) != 0) {
+            keep_version(leaf);  // before func, even if it changes nothing
+        }
+        std::string before = record_bytes(value);
+        VT after = value;
+        bool go_on = call_visitor(func, after);
+        if (record_bytes(after) != before) {
+            std::string image = encode_record(wal_update, leaf->keys_[pos], after);
+            value = std::move(after);
+            leaf.mark_dirty();
+            lsn = append_record(image);  // the after-image
+            changed = true;
+        }
+        return go_on;
+    }
+
+    // Range search (mode 0 denotes repeartedly search)
+    // a leaf is dirty only if the function really changed one of its values
+    template <class FUNC>
+    void range_search(KT key_start, KT key_end, FUNC &func, int mode);
+
+    // Range search without edit
+    template <class FUNC>
+    void range_read(KT key_start, KT key_end, FUNC &func, int mode);
+
+    // Walk the leaves of <st~ed> latched in leaf_mode, visit(leaf, pos) is called
+    // on each record until it returns false
+    template <class VISIT>
+    void range_walk(KT key_start, KT key_end, VISIT &&visit, int mode, LATCH_MODE leaf_mode);
+
+    // Call a search callback, false if it asks to stop
+    template <class FUNC, class T>
+    static bool call_visitor(FUNC &func, T &value) {
+        if constexpr (std::is_same<decltype(func(value)), bool>::value) {
+            return func(value);
+        } else {
+            func(value);
+            return true;
+        }
+    }
+};
+
+/*!
+ * @brief cursor class
+ * @brief walks the leaf chain forward (next_page_) or backward (prev_page_)
+ *      - read only, the leaf under the cursor stays pinned but not latched, the
+ *        current record is copied out while the leaf is read-latched
+ *      - if a writer changed the leaf in between, the cursor finds its place
+ *        again by key, so it never stops at the same key twice
+ *      - end() is true once it walks off either end of the tree
+ */
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+class bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor {
+public:
+    explicit cursor(bptree *tree) : tree_(tree), pos_(0), version_(0) {}
+
+    // copy pins the leaf again
+    cursor(const cursor &other)
+        : tree_(other.tree_), key_(other.key_), value_(other.value_), pos_(other.pos_),
+          version_(other.version_) {
+        if (other.leaf_) {
+            leaf_ = other.leaf_.pin();
+        }
+    }
+    cursor &operator=(const cursor &other) {
+        if (this != &other) {
+            tree_ = other.tree_;
+            leaf_ = other.leaf_ ? other.leaf_.pin() : node_handle();
+            key_ = other.key_;
+            value_ = other.value_;
+            pos_ = other.pos_;
+            version_ = other.version_;
+        }
+        return *this;
+    }
+    cursor(cursor &&other) = default;
+    cursor &operator=(cursor &&other) = default;
+
+    // Whether the cursor is out of the tree
+    bool end() const { return !leaf_; }
+
+    // Current record
+    const KT &key() const { return key_; }
+    const VT &value() const { return value_; }
+
+    // Move to the first key >= key
+    void seek(KT key);
+
+    // Move to the next / previous key
+    void next();
+    void prev();
+
+protected:
+    friend class bptree;
+
+    bptree *tree_;
+    node_handle leaf_;
+    KT key_;
+    VT value_;
+    int pos_;
+    uint32_t version_;  // of the leaf latch when pos_ was right
+
+    // The leaf is read-latched at pos_: copy the record out and let the latch go
+    void settle() {
+        key_ = leaf_->keys_[pos_];
+        value_ = leaf_->values_[pos_];
+        version_ = leaf_.version();
+        leaf_.unlatch();
+    }
+
+    // The leaf is read-latched: whether it was emptied and dropped meanwhile
+    bool leaf_dead() const { return leaf_->key_num_ == 0 || leaf_.discarded(); }
+
+    // The leaf is read-latched at pos_, maybe past its end: go right until a record.
+    // by_key if keys may have moved right since we saw key_, so those at or
+    // before it may be in the next leaves too.
+    void skip_right(bool by_key) {
+        while (pos_ == leaf_->key_num_) {
+            if (leaf_->next_page_ == -1) {
+                leaf_.release();
+                return;
+            }
+            leaf_ = tree_->pool_.fetch(leaf_->next_page_, latch_shared);
+            pos_ = by_key ? leaf_->upper_bound(key_) : 0;
+        }
+        settle();
+    }
+};
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor::seek(KT key) {
+    leaf_.release();
+    leaf_ = tree_->find_leaf(key, latch_shared);
+    if (!leaf_) {
+        return;
+    }
+    pos_ = leaf_->lower_bound(key);
+    skip_right(false);  // the key may live in the next leaf
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor::next() {
+    if (!leaf_) {
+        return;
+    }
+    leaf_.latch(latch_shared);
+    bool changed = leaf_.version() != version_;
+    if (!changed) {
+        pos_++;
+    } else if (!leaf_dead()) {
+        pos_ = leaf_->upper_bound(key_);
+    } else {
+        // our leaf is gone, look for the key after ours from the root
+        KT key = key_;
+        seek(key);
+        if (leaf_ && !(key < key_)) {
+            next();
+        }
+        return;
+    }
+    skip_right(changed);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor::prev() {
+    if (!leaf_) {
+        return;
+    }
+    leaf_.latch(latch_shared);
+    if (leaf_.version() == version_) {
+        pos_--;
+    } else if (!leaf_dead()) {
+        pos_ = leaf_->lower_bound(key_) - 1;
+    } else {
+        pos_ = -1;  // found again below
+    }
+    // Going left is against the latch order: let our leaf go, latch the left
+    // one, then ours again and check that they still link to each other. Keys
+    // may move between the two meanwhile, so we look for the last key before
+    // ours rather than the last one.
+    while (pos_ < 0 && !leaf_dead()) {
+        if (leaf_->prev_page_ == -1) {
+            leaf_.release();
+            return;
+        }
+        page_id_t prev_id = leaf_->prev_page_;
+        leaf_.unlatch();
+        node_handle prev_node = tree_->pool_.fetch(prev_id, latch_shared);
+        leaf_.latch(latch_shared);
+        if (!leaf_dead() && leaf_->prev_page_ == prev_id &&
+            prev_node->next_page_ == leaf_.page_id() && !prev_node.discarded()) {
+            leaf_ = std::move(prev_node);
+        } else {
+            prev_node.release();
+        }
+        pos_ = leaf_->lower_bound(key_) - 1;
+    }
+    if (pos_ < 0) {
+        // our leaf is gone, look for the key before ours from the root
+        KT key = key_;
+        seek(key);
+        if (end()) {
+            *this = tree_->last();
+        } else {
+            prev();
+        }
+        return;
+    }
+    settle();
+}
+
+/*!
+ * @brief snapshot class
+ * @brief the tree as it was at take_snapshot(), read only
+ *      - a page changed since then is read from the version kept for it,
+ *        any other one is the live node, latched shared while it is read
+ *      - writers are not held up, they copy a node the first time they change
+ *        it after a snapshot and go on
+ *      - the versions stay in memory until no open snapshot reads them, so
+ *        release snapshots soon, and before the tree goes
+ */
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+class bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot {
+public:
+    // move only, each snapshot is released once
+    snapshot(const snapshot &) = delete;
+    snapshot &operator=(const snapshot &) = delete;
+    snapshot(snapshot &&other) noexcept
+        : tree_(other.tree_), epoch_(other.epoch_), root_(other.root_) {
+        other.tree_ = nullptr;
+    }
+    snapshot &operator=(snapshot &&other) noexcept {
+        if (this != &other) {
+            release();
+            tree_ = other.tree_;
+            epoch_ = other.epoch_;
+            root_ = other.root_;
+            other.tree_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~snapshot() { release(); }
+
+    // Let the tree drop the versions kept for it, the snapshot is unusable then
+    void release() {
+        if (tree_) {
+            tree_->release_snapshot(epoch_);
+            tree_ = nullptr;
+        }
+    }
+
+    // Like those of the tree, on the records as they were
+    std::optional<VT> find(KT key) const;
+    bool contains(KT key) const;
+
+    // Call func(value) on each record of <st~ed>, a callback returning false
+    // stops it. Nothing in range is no error.
+    template <class FUNC>
+    void read(KT st, KT ed, FUNC &&func) const;
+
+    // bptree::parallel_scan() on the records as they were
+    template <class T, class FOLD, class MERGE>
+    T parallel_scan(KT st, KT ed, FOLD &&fold, MERGE &&merge, bool ordered = true,
+                    unsigned threads = 0) const {
+        return tree_->template scan_parts<T>(
+            st, ed, fold, merge, ordered, threads,
+            [this](const KT &start, auto &&visit) { walk_from(start, visit); });
+    }
+
+protected:
+    friend class bptree;
+
+    snapshot(bptree *tree, uint64_t epoch, page_id_t root)
+        : tree_(tree), epoch_(epoch), root_(root) {}
+
+    // Go down to the leaf of key, empty if the tree was
+    node_view leaf_of(const KT &key) const;
+
+    // Walk the leaves from key_start on, visit(leaf, pos) is called on each
+    // record until it returns false
+    template <class VISIT>
+    void walk_from(const KT &key_start, VISIT &&visit) const;
+
+    bptree *tree_;     // null once released
+    uint64_t epoch_;
+    page_id_t root_;   // root_ of the tree at the time
+};
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_view
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot::leaf_of(const KT &key) const {
+    // Note:
+    // No crabbing, the pages of a snapshot never change under it (a writer keeps
+    // the version first), so a node is let go before its child is read.
+    if (root_ == -1) {
+        return node_view();
+    }
+    node_view node = tree_->view_node(root_, epoch_);
+    while (!node->is_leaf_) {
+        page_id_t child = node->sub_ptrs_[node->upper_bound(key)];
+        node = node_view();
+        node = tree_->view_node(child, epoch_);
+    }
+    return node;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class VISIT>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot::walk_from(
+    const KT &key_start, VISIT &&visit) const {
+    node_view leaf = leaf_of(key_start);
+    if (!leaf) {
+        return;
+    }
+    int pos = leaf->lower_bound(key_start);
+    while (true) {
+        for (; pos < leaf->key_num_; ++pos) {
+            if (!visit(*leaf, pos)) {
+                return;
+            }
+        }
+        page_id_t next = leaf->next_page_;
+        if (next == -1) {
+            return;
+        }
+        leaf = node_view();  // see leaf_of()
+        leaf = tree_->view_node(next, epoch_);
+        pos = 0;
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::optional<VT> bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot::find(
+    KT key) const {
+    std::optional<VT> value;
+    node_view leaf = leaf_of(key);
+    if (leaf) {
+        int pos = leaf->lower_bound(key);
+        if (pos < leaf->key_num_ && leaf->keys_[pos] == key) {
+            value = leaf->values_[pos];
+        }
+    }
+    return value;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+bool bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot::contains(
+    KT key) const {
+    node_view leaf = leaf_of(key);
+    if (!leaf) {
+        return false;
+    }
+    int pos = leaf->lower_bound(key);
+    return pos < leaf->key_num_ && leaf->keys_[pos] == key;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class FUNC>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot::read(
+    KT st, KT ed, FUNC &&func) const {
+    if (ed < st) {
+        throw std::invalid_argument("snapshot::read: ed < st");
+    }
+    walk_from(st, [&](const node_t &leaf, int pos) {
+        return !(ed < leaf.keys_[pos]) && call_visitor(func, leaf.values_[pos]);
+    });
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::first() {
+    cursor cur(this);
+    node_handle leaf = find_leaf_by([](const node_t &) { return 0; }, latch_shared);
+    if (leaf) {
+        cur.pos_ = 0;
+        cur.leaf_ = std::move(leaf);
+        cur.settle();
+    }
+    return cur;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::last() {
+    cursor cur(this);
+    node_handle leaf =
+        find_leaf_by([](const node_t &node) { return node.key_num_; }, latch_shared);
+    if (leaf) {
+        cur.pos_ = leaf->key_num_ - 1;
+        cur.leaf_ = std::move(leaf);
+        cur.settle();
+    }
+    return cur;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::lower_bound(KT key) {
+    cursor cur(this);
+    cur.seek(key);
+    return cur;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::size() {
+    static_assert(COUNTS, "size: the tree keeps no counts");
+    std::shared_lock<rw_latch> root_lock(root_latch_);
+    if (root_ == -1) {
+        return 0;
+    }
+    return pool_.fetch(root_, latch_shared)->record_count();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::count(KT st, KT ed) {
+    static_assert(COUNTS, "count: the tree keeps no counts");
+    if (ed < st) {
+        throw std::invalid_argument("count: ed < st");
+    }
+    // Note:
+    // Every writer that changes a count holds root_latch_ exclusively, so both
+    // ways down see the same tree.
+    std::shared_lock<rw_latch> root_lock(root_latch_);
+    return count_below(ed, true) - count_below(st, false);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::rank(KT key) {
+    static_assert(COUNTS, "rank: the tree keeps no counts");
+    std::shared_lock<rw_latch> root_lock(root_latch_);
+    return count_below(key, false);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::cursor
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::select(std::size_t k) {
+    static_assert(COUNTS, "select: the tree keeps no counts");
+    cursor cur(this);
+    std::shared_lock<rw_latch> root_lock(root_latch_);
+    if (root_ == -1) {
+        return cur;
+    }
+    node_handle node = pool_.fetch(root_, latch_shared);
+    if (k >= std::size_t(node->record_count())) {
+        return cur;
+    }
+    // skip the children before the k-th record
+    while (!node->is_leaf_) {
+        int pos = 0;
+        while (k >= std::size_t(node->counts_[pos])) {
+            k -= node->counts_[pos];
+            pos++;
+        }
+        node_handle child = pool_.fetch(node->sub_ptrs_[pos], latch_shared);
+        node = std::move(child);
+    }
+    cur.pos_ = k;
+    cur.leaf_ = std::move(node);
+    cur.settle();
+    return cur;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::count_below(
+    const KT &key, bool inclusive) {
+    // Note:
+    // A child left of the way down has keys below its separator, which is
+    // below key (at most key if inclusive), and one right of it has keys from
+    // its separator on, so only the leaf we reach is split by key.
+    if (root_ == -1) {
+        return 0;
+    }
+    std::size_t count = 0;
+    node_handle node = pool_.fetch(root_, latch_shared);
+    while (!node->is_leaf_) {
+        int pos = inclusive ? node->upper_bound(key) : node->lower_bound(key);
+        for (int i = 0; i < pos; ++i) {
+            count += node->counts_[i];
+        }
+        node_handle child = pool_.fetch(node->sub_ptrs_[pos], latch_shared);
+        node = std::move(child);
+    }
+    return count + (inclusive ? node->upper_bound(key) : node->lower_bound(key));
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::bptree(std::string name,
+                                                                 std::size_t pool_size,
+                                                                 wal_options options)
+    : store_(name + ".db", PAGE_SIZE), pool_(&store_, pool_size), filter_bits_(0),
+      readahead_(0), epoch_(0), latest_snapshot_(0) {
+    // get the root_ page_id from the meta page
+    char buf[PAGE_SIZE];
+    store_.read_page(0, buf);
+    page_reader reader(buf, PAGE_SIZE);
+    uint32_t magic;
+    reader.get(magic);
+    page_id_t free_head = 0;
+    if (magic != META_MAGIC) {
+        root_ = -1;
+        page_id_counter_ = 0;
+    } else {
+        reader.get(root_);
+        reader.get(page_id_counter_);
+        uint32_t page_size;
+        uint8_t prefix_keys;
+        reader.get(page_size);
+        reader.get(prefix_keys);
+        if (page_size != PAGE_SIZE || prefix_keys != PREFIX_KEYS) {
+            throw std::runtime_error("bptree: " + name + ".db has another page layout");
+        }
+        reader.get(free_head);  // 0 in files from before the free list
+        uint8_t counts;
+        reader.get(counts);  // and 0 from before counts
+        uint8_t binary;
+        reader.get(binary);  // and before binary record layouts
+        if (counts != COUNTS || binary != binary_record<VT>::value) {
+            throw std::runtime_error("bptree: " + name + ".db has another page layout");
+        }
+    }
+    read_free_list(free_head);
+    saved_root_ = root_;
+    saved_page_id_counter_ = page_id_counter_;
+    saved_free_head_ = free_head;
+
+    // then the log on top of it
+    wal_options_ = options;
+    checkpoint_pages_ = options.checkpoint_pages != 0 ? options.checkpoint_pages
+                                                      : std::max<std::size_t>(1, pool_size / 2);
+    replaying_ = false;
+    if (options.enabled) {
+        wal_ = std::make_unique<wal>(name + ".wal", options.commit_window);
+        pool_.set_no_steal(true);
+        recover();
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::~bptree() {
+    flush();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::flush() {
+    std::unique_lock<std::shared_mutex> lock(tree_latch_);
+    flush_locked();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::flush_locked() {
+    if (wal_) {
+        checkpoint();
+        return;
+    }
+    pool_.flush();
+    write_meta();
+    store_.flush();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::write_meta() {
+    if (root_ == saved_root_ && page_id_counter_ == saved_page_id_counter_ &&
+        free_head() == saved_free_head_) {
+        return;  // meta page unchanged
+    }
+    char buf[PAGE_SIZE] = {0};
+    page_writer writer(buf, PAGE_SIZE);
+    writer.put(META_MAGIC);
+    writer.put(root_);
+    writer.put(page_id_counter_);
+    writer.put(uint32_t(PAGE_SIZE));
+    writer.put(uint8_t(PREFIX_KEYS));
+    writer.put(free_head());
+    writer.put(uint8_t(COUNTS));
+    writer.put(uint8_t(binary_record<VT>::value));
+    store_.write_page(0, buf);
+    saved_root_ = root_;
+    saved_page_id_counter_ = page_id_counter_;
+    saved_free_head_ = free_head();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::free_page_image(std::size_t i,
+                                                                               char *buf) const {
+    std::memset(buf, 0, PAGE_SIZE);
+    page_writer writer(buf, PAGE_SIZE);
+    writer.put(uint8_t(free_page));
+    writer.put(i == 0 ? page_id_t(0) : free_pages_[i - 1]);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::read_free_list(page_id_t head) {
+    free_pages_.clear();
+    char buf[PAGE_SIZE];
+    for (page_id_t page_id = head; page_id != 0;) {
+        store_.read_page(page_id, buf);
+        page_reader reader(buf, PAGE_SIZE);
+        uint8_t kind;
+        reader.get(kind);
+        if (kind != free_page || free_pages_.size() > std::size_t(page_id_counter_)) {
+            throw std::runtime_error("bptree: broken free list");
+        }
+        free_pages_.push_back(page_id);
+        reader.get(page_id);
+    }
+    std::reverse(free_pages_.begin(), free_pages_.end());
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::checkpoint() {
+    bool meta_changed = root_ != saved_root_ || page_id_counter_ != saved_page_id_counter_ ||
+                        free_head() != saved_free_head_;
+    if (pool_.dirty_count() == 0 && !meta_changed && pending_free_.empty() && wal_->empty()) {
+        return;
+    }
+    // Firstly, page images and the meta go to the log. If we crash while
+    // writing the data file, the images are copied again on open.
+    // Pages freed since the last checkpoint join the free list here.
+    std::vector<char> buf(1 + sizeof(page_id_t) + PAGE_SIZE);
+    buf[0] = wal_page;
+    pool_.for_each_dirty([&](page_id_t page_id, node_t &node) {
+        std::memcpy(&buf[1], &page_id, sizeof(page_id));
+        node.serialize(&buf[1 + sizeof(page_id)]);
+        wal_->append(buf.data(), buf.size());
+    });
+    std::size_t first_freed = free_pages_.size();
+    free_pages_.insert(free_pages_.end(), pending_free_.begin(), pending_free_.end());
+    pending_free_.clear();
+    for (std::size_t i = first_freed; i < free_pages_.size(); ++i) {
+        std::memcpy(&buf[1], &free_pages_[i], sizeof(page_id_t));
+        free_page_image(i, &buf[1 + sizeof(page_id_t)]);
+        wal_->append(buf.data(), buf.size());
+    }
+    log_record(wal_checkpoint, root_, page_id_counter_, free_head());
+    wal_->sync();
+
+    // Secondly, the data file
+    pool_.flush();
+    for (std::size_t i = first_freed; i < free_pages_.size(); ++i) {
+        free_page_image(i, buf.data());
+        store_.write_page(free_pages_[i], buf.data());
+    }
+    write_meta();
+    store_.sync();
+
+    // Thirdly, the log is not needed anymore
+    wal_->reset();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::recover() {
+    // no record is longer than a page image of a checkpoint
+    std::vector<std::string> records = wal_->read_all(1 + sizeof(page_id_t) + PAGE_SIZE);
+    // the last complete checkpoint, its page images are right before it
+    std::size_t start = 0;
+    for (std::size_t i = records.size(); i-- > 0;) {
+        if (uint8_t(records[i][0]) != wal_checkpoint) {
+            continue;
+        }
+        std::size_t first_image = i;
+        while (first_image > 0 && uint8_t(records[first_image - 1][0]) == wal_page) {
+            first_image--;
+        }
+        for (std::size_t k = first_image; k < i; ++k) {
+            page_id_t page_id;
+            std::memcpy(&page_id, &records[k][1], sizeof(page_id));
+            store_.write_page(page_id, &records[k][1 + sizeof(page_id)]);
+        }
+        page_reader reader(records[i].data() + 1, records[i].size() - 1);
+        page_id_t free_head;
+        reader.get(root_);
+        reader.get(page_id_counter_);
+        reader.get(free_head);
+        read_free_list(free_head);
+        start = i + 1;
+        break;
+    }
+    // then redo what came after it
+    replaying_ = true;
+    for (std::size_t i = start; i < records.size(); ++i) {
+        page_reader reader(records[i].data() + 1, records[i].size() - 1);
+        KT key;
+        VT value;
+        switch (uint8_t(records[i][0])) {
+            case wal_insert:
+                reader.get(key);
+                reader.get(value);
+                insert(key, value);
+                break;
+            case wal_remove:
+                reader.get(key);
+                remove(key);
+                break;
+            case wal_update:
+                reader.get(key);
+                reader.get(value);
+                search(key, [&](VT &cur) {
+                    cur = value;
+                    return false;
+                });
+                break;
+            default:  // images of a checkpoint that did not finish
+                break;
+        }
+    }
+    replaying_ = false;
+    checkpoint();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class... T>
+std::string bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::encode_record(
+    WAL_KIND kind, const T &...fields) {
+    if (replaying_) {
+        return std::string();  // read back from the log, they fit
+    }
+    char buf[1 + (record_size<T>() + ... + 0)];
+    page_writer writer(buf, sizeof(buf));
+    writer.put(uint8_t(kind));
+    (writer.put(fields), ...);
+    return std::string(buf, writer.pos());
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::end_op(uint64_t lsn) {
+    if (!wal_ || replaying_) {
+        return;
+    }
+    wal_->commit(lsn, wal_options_.sync_commit);
+    if (pool_.dirty_count() >= checkpoint_pages_) {
+        std::unique_lock<std::shared_mutex> lock(tree_latch_);
+        maybe_checkpoint();  // someone else may have done it meanwhile
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::maybe_checkpoint() {
+    if (wal_ && !replaying_ && pool_.dirty_count() >= checkpoint_pages_) {
+        checkpoint();
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class CHOOSE>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_handle
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::find_leaf_by(
+    CHOOSE &&choose, LATCH_MODE mode, const KT *probe) {
+    if constexpr (OPTIMISTIC) {
+        node_handle leaf;
+        uint32_t root_version;
+        for (int spin = 0; !try_find_leaf(choose, mode, leaf, root_version, nullptr, probe);
+             ++spin) {
+            rw_latch::backoff(spin);
+        }
+        return leaf;
+    } else {
+        std::shared_lock<rw_latch> root_lock(root_latch_);
+        if (root_ == -1) {
+            return node_handle();
+        }
+        node_handle cur_node = pool_.fetch(root_, latch_shared);
+        node_handle par_node;
+        while (!cur_node->is_leaf_) {
+            // latch the child, then let the grandparent go
+            page_id_t child_id = cur_node->sub_ptrs_[choose(*cur_node)];
+            if (probe && !filter_may_contain(child_id, *probe)) {
+                return node_handle();  // only leaves have filters
+            }
+            node_handle child = pool_.fetch(child_id, latch_shared);
+            par_node = std::move(cur_node);
+            cur_node = std::move(child);
+            if (root_lock.owns_lock()) {
+                root_lock.unlock();
+            }
+        }
+        if (mode != latch_shared) {
+            // the parent is still latched, so the leaf can not split or go away meanwhile
+            cur_node.unlatch();
+            cur_node.latch(mode);
+        }
+        return cur_node;
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class CHOOSE>
+bool bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::try_find_leaf(
+    CHOOSE &choose, LATCH_MODE mode, node_handle &leaf, uint32_t &root_version,
+    std::vector<seen_node> *seen, const KT *probe) {
+    // Note:
+    // Each node is read at some version, then its parent is checked. If the
+    // parent did not change, the node was really its child when we read it.
+    std::vector<seen_node> nodes;
+    if (seen == nullptr) {
+        seen = &nodes;
+    }
+    seen->clear();
+    if (!root_latch_.read_begin(root_version)) {
+        return false;
+    }
+    page_id_t page_id = root_;
+    auto parent_valid = [&] {
+        return seen->empty() ? root_latch_.read_validate(root_version)
+                             : seen->back().node.read_validate(seen->back().version);
+    };
+    if (!parent_valid()) {
+        return false;
+    }
+    if (page_id == -1) {
+        leaf = node_handle();
+        return true;
+    }
+    while (true) {
+        node_handle node = pool_.fetch(page_id);
+        uint32_t version;
+        if (!node.read_begin(version) || !parent_valid()) {
+            return false;
+        }
+        if (node->is_leaf_) {
+            // latch it, waiting is fine as nothing else is latched, then make
+            // sure it did not split or go away before we got there (an empty
+            // leaf is on its way out, compact() leaves them so after the parent)
+            node.latch(mode);
+            if (!parent_valid() || node.discarded() || node->key_num_ == 0) {
+                return false;
+            }
+            leaf = std::move(node);
+            return true;
+        }
+        page_id = node->sub_ptrs_[choose(*node)];
+        bool filtered_out = probe && !filter_may_contain(page_id, *probe);
+        if (!node.read_validate(version)) {
+            return false;  // page_id may be anything
+        }
+        if (filtered_out) {
+            leaf = node_handle();
+            return true;
+        }
+        seen->push_back({std::move(node), version});
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_handle
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::write_leaf(
+    KT key, WRITE_KIND kind, std::vector<node_handle> &path,
+    std::unique_lock<rw_latch> &root_lock) {
+    if constexpr (OPTIMISTIC) {
+        // give up after this many tries and latch from the top
+        constexpr int TRIES = 8;
+        auto choose = [&](const node_t &node) { return node.upper_bound(key); };
+        std::vector<seen_node> seen;
+        for (int attempt = 0; attempt < TRIES; ++attempt) {
+            node_handle leaf;
+            uint32_t root_version;
+            if (!try_find_leaf(choose, latch_exclusive, leaf, root_version, &seen)) {
+                rw_latch::backoff(attempt);
+                continue;
+            }
+            if (!leaf) {
+                break;  // empty tree, lock_path() takes root_lock for the first leaf
+            }
+            if (write_safe(*leaf, kind, key)) {
+                return leaf;
+            }
+            // Latch upwards what the write changes. That goes against the latch
+            // order, so we never wait: if a node is taken or was changed, start over.
+            std::size_t top = seen.size();  // seen[top..] are latched
+            bool latched = true;
+            while (true) {
+                if (top == 0) {
+                    // root_ changes too
+                    latched = root_latch_.try_upgrade(root_version);
+                    if (latched) {
+                        root_lock = std::unique_lock<rw_latch>(root_latch_, std::adopt_lock);
+                    }
+                    break;
+                }
+                if (!seen[top - 1].node.try_upgrade(seen[top - 1].version)) {
+                    latched = false;
+                    break;
+                }
+                top--;
+                if (write_safe(*seen[top].node, kind, key)) {
+                    break;
+                }
+            }
+            if (latched) {
+                for (std::size_t i = top; i < seen.size(); ++i) {
+                    path.emplace_back(std::move(seen[i].node));
+                }
+                return leaf;
+            }
+            seen.clear();
+            leaf.release();
+            rw_latch::backoff(attempt);
+        }
+        return lock_path(key, kind, path, root_lock);
+    } else {
+        // most of the time the leaf is all we latch
+        node_handle leaf = find_leaf(key, latch_exclusive);
+        if (leaf && write_safe(*leaf, kind, key)) {
+            return leaf;
+        }
+        // it may split or go empty, go down again and keep what may change
+        leaf.release();
+        return lock_path(key, kind, path, root_lock);
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_handle
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::lock_path(
+    KT key, WRITE_KIND kind, std::vector<node_handle> &path,
+    std::unique_lock<rw_latch> &root_lock, std::optional<KT> *fence) {
+    // Note:
+    // parent_page_ used to be saved in each node, but splits moved children
+    // without updating it, so we remember the path on the way down instead.
+    if (!root_lock.owns_lock()) {
+        root_lock.lock();
+    }
+    if (root_ == -1) {
+        return node_handle();
+    }
+    node_handle cur_node = pool_.fetch(root_, latch_exclusive);
+    while (true) {
+        if (write_safe(*cur_node, kind, key)) {
+            // nothing above changes
+            path.clear();
+            if (root_lock.owns_lock()) {
+                root_lock.unlock();
+            }
+        }
+        if (cur_node->is_leaf_) {
+            return cur_node;
+        }
+        auto key_pos = cur_node->upper_bound(key);
+        if (fence != nullptr && key_pos < cur_node->key_num_) {
+            *fence = cur_node->keys_[key_pos];
+        }
+        page_id_t child = cur_node->sub_ptrs_[key_pos];
+        path.emplace_back(std::move(cur_node));
+        cur_node = pool_.fetch(child, latch_exclusive);
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_handle
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::new_node() {
+    page_id_t page_id;
+    {
+        // reuse a free page before growing the file
+        std::lock_guard<std::mutex> lock(page_mutex_);
+        if (!free_pages_.empty()) {
+            page_id = free_pages_.back();
+            free_pages_.pop_back();
+        } else {
+            page_id = ++page_id_counter_;
+        }
+    }
+    return pool_.create(page_id);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::free_node(node_handle &node) {
+    if (latest_snapshot_.load(std::memory_order_relaxed) != 0) {
+        keep_version(node);  // the page may come back as another node
+    }
+    page_id_t page_id = node.page_id();
+    node.release();
+    pool_.discard(page_id);
+    {
+        // after the discard, so that nobody builds it again (see filter_build)
+        std::unique_lock<std::shared_mutex> lock(filter_mutex_);
+        filters_.erase(page_id);
+    }
+    std::lock_guard<std::mutex> lock(page_mutex_);
+    add_free_page(page_id);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::add_free_page(page_id_t page_id) {
+    if (wal_) {
+        pending_free_.push_back(page_id);  // the last checkpoint still uses it
+    } else {
+        char buf[PAGE_SIZE];
+        free_pages_.push_back(page_id);
+        free_page_image(free_pages_.size() - 1, buf);
+        store_.write_page(page_id, buf);
+    }
+}
 
-    // Destructor
-    ~bptree();
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::insert(KT key, VT value) {
+    uint64_t lsn;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_latch_);
+        lsn = insert_one(key, value);
+    }
+    end_op(lsn);
+}
 
-    // Order related arguments
-    // constexpr int get_max_internal_node_limit() { return ceil(ORDER / 2); }
-    constexpr int get_max_internal_node_limit() { return ORDER - 1; }
-    constexpr int get_max_leaf_node_limit() { return ORDER - 1; }
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+uint64_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::insert_one(KT key, VT value) {
+    // Notes:
+    // first's prev is -1, so do last's next
 
-    // Insert <key,value> to the B+ tree
-    void insert(KT key, VT value);
+    // the log record first, a value that does not fit throws with nothing changed
+    std::string image = encode_record(wal_insert, key, value);
 
-    // Remove <key> in the B+ tree
-    void remove(KT key);
+    // get the leaf node, and the nodes above if it splits
+    std::vector<node_handle> path;
+    std::unique_lock<rw_latch> root_lock(root_latch_, std::defer_lock);
+    node_handle cur_node = write_leaf(key, write_insert, path, root_lock);
 
-    // Search <key> in the B+ tree and call the function
-    void search(KT key, std::function<void(VT &)> func, int mode = 0) {
-        range_search(key, key, func, mode);
+    if (!cur_node) {  // case of empty tree
+        // generate a new root
+        node_handle tmp_node = new_node();
+        tmp_node->is_leaf_ = true;
+        tmp_node->key_num_ = 1;
+        tmp_node->next_page_ = -1;
+        tmp_node->prev_page_ = -1;
+        tmp_node->keys_.push_back(key);
+        tmp_node->values_.push_back(value);
+        root_ = tmp_node.page_id();
+        return append_record(image);
     }
 
-    // Search <st~ed> in the B+ tree and call the function
-    void search(KT st, KT ed, std::function<void(VT &)> func, int mode = 0) {
-        range_search(st, ed, func, mode);
+    // insert key-value
+    before_change(cur_node);
+    int key_pos = cur_node->upper_bound(key);
+    cur_node->keys_.insert(cur_node->keys_.begin() + key_pos, key);
+    cur_node->values_.insert(cur_node->values_.begin() + key_pos, value);
+    cur_node->key_num_++;
+    filter_add(cur_node, key);
+    count_path(path, key, 1);
+    uint64_t lsn = append_record(image);
+    // keys coming in order into this leaf, e.g. the serials of one tube among others
+    bool in_order = cur_node->last_insert_ != -1 && key_pos == cur_node->last_insert_ + 1;
+    cur_node->last_insert_ = key_pos;
+    if (cur_node->overflow()) {
+        // NOW we have to split the nodes, the new key alone goes to one side
+        // if it is past either end of the tree, and it starts the right one
+        // if keys come in order
+        SPLIT_KIND edge = cur_node->next_page_ == -1   ? split_append
+                          : cur_node->prev_page_ == -1 ? split_prepend
+                                                       : split_half;
+        SPLIT_KIND kind = in_order ? split_append : split_kind(*cur_node, key_pos, edge);
+        int mid = kind == split_append    ? key_pos
+                  : kind == split_prepend ? 1
+                                          : cur_node->key_num_ / 2;
+        node_handle right_node = new_node();
+        right_node->keys_.assign(cur_node->keys_.begin() + mid, cur_node->keys_.end());
+        right_node->values_.assign(cur_node->values_.begin() + mid, cur_node->values_.end());
+        right_node->is_leaf_ = true;
+        right_node->key_num_ = right_node->keys_.size();
+        right_node->last_insert_ = key_pos < mid ? -1 : key_pos - mid;
+        cur_node->last_insert_ = key_pos < mid ? key_pos : -1;
+        right_node->next_page_ = cur_node->next_page_;
+        right_node->prev_page_ = cur_node.page_id();
+        cur_node->next_page_ = right_node.page_id();
+        if (right_node->next_page_ != -1) {
+            node_handle tmp_node = pool_.fetch(right_node->next_page_, latch_exclusive);
+            before_change(tmp_node);
+            tmp_node->prev_page_ = right_node.page_id();
+        }
+        cur_node->keys_.resize(mid);
+        cur_node->values_.resize(mid);
+        cur_node->key_num_ = cur_node->keys_.size();
+        // update the parent node
+        if (path.empty()) {  // cur_node is the root node, root_lock is held
+            // create a new root
+            grow_root(cur_node.page_id(), right_node.page_id(), right_node->keys_[0],
+                      cur_node->key_num_, right_node->key_num_);
+        } else {  // cur_node is the internal node
+            // insert new key in parent node
+            KT add_key = right_node->keys_[0];
+            page_id_t right_page_id = right_node.page_id();
+            int right_count = right_node->key_num_;
+            cur_node.release();
+            right_node.release();
+            insert_update_parent(path, right_page_id, add_key, right_count, kind);  // recursion
+        }
     }
+    return lsn;
+}
 
-protected:
-    page_id_t root_;           // Root of the B+VTree
-    std::string folder_name_;  // Folder name of the B+VTree
-    int page_id_counter_;      // Counter of the page id.
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::insert_batch(
+    std::vector<std::pair<KT, VT>> records) {
+    std::stable_sort(records.begin(), records.end(),
+                     [](const std::pair<KT, VT> &a, const std::pair<KT, VT> &b) {
+                         return a.first < b.first;
+                     });
+    // all encoded first, a record that does not fit throws before any leaf changes
+    std::vector<std::string> images;
+    images.reserve(records.size());
+    for (auto &record : records) {
+        images.emplace_back(encode_record(wal_insert, record.first, record.second));
+    }
+    // other writers wait, readers go on
+    std::unique_lock<std::shared_mutex> lock(tree_latch_);
+    if (root_ == -1) {  // case of empty tree
+        load_sorted(records.begin(), records.end(), 1.0);
+        return;
+    }
+    std::size_t i = 0;
+    std::size_t logged = 0;
+    uint64_t lsn = 0;
+    while (i < records.size()) {
+        // the leaves so far are done, log them (and maybe checkpoint) now
+        // so that a big batch does not pile up dirty nodes
+        for (; logged < i; ++logged) {
+            lsn = append_record(images[logged]);
+        }
+        maybe_checkpoint();
 
-    // Update the parent node after insert
-    void insert_update_parent(page_id_t par, page_id_t cur, KT key);
+        // get the leaf node, and the keys that belong to it,
+        // the whole path stays latched for this leaf
+        std::vector<node_handle> path;
+        std::unique_lock<rw_latch> root_lock(root_latch_, std::defer_lock);
+        std::optional<KT> fence;
+        node_handle cur_node = lock_path(records[i].first, write_batch, path, root_lock, &fence);
+        std::size_t j = i;
+        while (j < records.size() && (!fence || records[j].first < *fence)) {
+            j++;
+        }
+        count_path(path, records[i].first, j - i);
 
-    // Update the parent node after remove
-    void remove_update_parent(bpnode<KT, VT, ORDER> &node, page_id_t child_page);
+        // all of them past the last leaf, like serials handed out in order,
+        // or past a leaf whose last key went in at its end too
+        bool at_end = cur_node->key_num_ == 0 || !(records[i].first < cur_node->keys_.back());
+        bool append = at_end && (cur_node->next_page_ == -1 ||
+                                 cur_node->last_insert_ == cur_node->key_num_ - 1);
 
-    // Range search (mode 0 denotes repeartedly search)
-    void range_search(KT key_start, KT key_end, std::function<void(VT &)>, int mode);
-};
+        // merge them into the leaf, new keys go after equal old keys
+        before_change(cur_node);
+        std::vector<KT> keys;
+        std::vector<VT> values;
+        keys.reserve(cur_node->key_num_ + j - i);
+        values.reserve(cur_node->key_num_ + j - i);
+        int old_pos = 0;
+        for (std::size_t k = i; k < j; ++k) {
+            while (old_pos < cur_node->key_num_ && !(records[k].first < cur_node->keys_[old_pos])) {
+                keys.emplace_back(cur_node->keys_[old_pos]);
+                values.emplace_back(cur_node->values_[old_pos]);
+                old_pos++;
+            }
+            keys.emplace_back(records[k].first);
+            values.emplace_back(records[k].second);
+            filter_add(cur_node, records[k].first);
+        }
+        keys.insert(keys.end(), cur_node->keys_.begin() + old_pos, cur_node->keys_.end());
+        values.insert(values.end(), cur_node->values_.begin() + old_pos, cur_node->values_.end());
+        i = j;
 
-template <class KT, class VT, std::size_t ORDER>
-bptree<KT, VT, ORDER>::bptree(std::string folder_name) {
-    folder_name_ = folder_name;
-    // get the root_ page_id
-    struct stat buf;
-    errno_t err = 0;
-    if (stat(std::string(folder_name_ + "/root.txt").c_str(), &buf) != 0) {
-        root_ = -1;
-        page_id_counter_ = 0;
-    } else {
-        std::ifstream root_file(folder_name_ + "/root.txt");
-        root_file >> root_;
-        root_file >> page_id_counter_;
-        root_file.close();
+        int total = keys.size();
+        int limit = node_t::leaf_limit(keys.front(), keys.back());
+        if (total <= limit) {
+            cur_node->keys_.assign(keys.begin(), keys.end());
+            cur_node->values_.assign(values.begin(), values.end());
+            cur_node->key_num_ = total;
+            cur_node->last_insert_ = at_end ? total - 1 : -1;
+            continue;
+        }
+        // split once, into as many evenly filled leaves as needed,
+        // or full ones but the last if appending
+        int piece_num = (total + limit - 1) / limit;
+        auto piece_start = [&](int k) {
+            return append ? std::min(total, k * limit) : total * k / piece_num;
+        };
+        std::vector<std::pair<KT, page_id_t>> pieces;  // first key and page of new leaves
+        node_handle prev_node = std::move(cur_node);
+        for (int k = 0; k < piece_num; ++k) {
+            int st = piece_start(k);
+            int ed = piece_start(k + 1);
+            node_handle piece;
+            if (k == 0) {
+                piece = std::move(prev_node);
+            } else {
+                piece = new_node();
+                piece->is_leaf_ = true;
+                piece->next_page_ = prev_node->next_page_;
+                piece->prev_page_ = prev_node.page_id();
+                prev_node->next_page_ = piece.page_id();
+                pieces.emplace_back(keys[st], piece.page_id());
+            }
+            piece->keys_.assign(keys.begin() + st, keys.begin() + ed);
+            piece->values_.assign(values.begin() + st, values.begin() + ed);
+            piece->key_num_ = ed - st;
+            piece->last_insert_ = at_end && k == piece_num - 1 ? ed - st - 1 : -1;
+            prev_node = std::move(piece);
+        }
+        if (prev_node->next_page_ != -1) {
+            node_handle tmp_node = pool_.fetch(prev_node->next_page_, latch_exclusive);
+            before_change(tmp_node);
+            tmp_node->prev_page_ = prev_node.page_id();
+        }
+        prev_node.release();
+        // update the parent node, once per new leaf. The parent counts all
+        // pieces under the one before, it moves this piece and those after it.
+        for (std::size_t k = 0; k < pieces.size(); ++k) {
+            if (k > 0) {
+                // the parent may have split, go down again
+                path.clear();
+                lock_path(pieces[k].first, write_batch, path, root_lock);
+            }
+            int moved = total - piece_start(k + 1);
+            if (path.empty()) {  // the leaf was the root
+                grow_root(root_, pieces[k].second, pieces[k].first, total - moved, moved);
+            } else {
+                insert_update_parent(path, pieces[k].second, pieces[k].first, moved,
+                                     append ? split_append : split_half);
+            }
+        }
+    }
+    for (; logged < records.size(); ++logged) {
+        lsn = append_record(images[logged]);
     }
+    lock.unlock();
+    end_op(lsn);
 }
 
-template <class KT, class VT, std::size_t ORDER>
-bptree<KT, VT, ORDER>::~bptree() {
-    std::ofstream root_file(folder_name_ + "/root.txt");
-    root_file << root_ << std::endl;
-    root_file << page_id_counter_ << std::endl;
-    root_file.close();
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class IT>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::bulk_load(IT first, IT last,
+                                                                         double fill_factor) {
+    std::unique_lock<std::shared_mutex> lock(tree_latch_);
+    load_sorted(first, last, fill_factor);
 }
 
-template <class KT, class VT, std::size_t ORDER>
-void bptree<KT, VT, ORDER>::insert(KT key, VT value) {
-    // Notes:
-    // Here is a little 'bug' in insert function
-    // acturally in prev_ptr and next_ptr (or pages)
-    // the prev ptr may be wrong.
-    // It could be configured, but considering the simplicity of the code,
-    // I don't think it is necessary. :-)
-    // Updated: first's prev is -1, so do last's next
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class IT>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::load_sorted(IT first, IT last,
+                                                                           double fill_factor) {
+    // error handling
+    if (root_ != -1) {
+        throw std::runtime_error("bulk_load: tree is not empty!");
+    }
+    if (fill_factor <= 0 || fill_factor > 1) {
+        throw std::invalid_argument("bulk_load: fill_factor should be in (0, 1]");
+    }
+    if (wal_) {
+        // not logged: the meta page says empty until the checkpoint at the end,
+        // so new pages may reach the data file on the way
+        checkpoint();
+        pool_.set_no_steal(false);
+    }
+    page_id_t root;
+    try {
+        root = build_sorted(first, last, fill_factor);
+    } catch (...) {
+        pool_.set_no_steal(wal_ != nullptr);
+        throw;
+    }
+    {
+        std::unique_lock<rw_latch> root_lock(root_latch_);
+        root_ = root;
+    }
+    if (wal_) {
+        pool_.set_no_steal(true);
+        checkpoint();
+    }
+}
 
-    if (root_ == -1) {  // case of empty tree
-        // generate a new root
-        bpnode<KT, VT, ORDER> tmp_node = bpnode<KT, VT, ORDER>(++page_id_counter_, folder_name_);
-        tmp_node.is_leaf_ = true;
-        tmp_node.key_num_ = 1;
-        tmp_node.next_page_ = -1;
-        tmp_node.prev_page_ = -1;
-        tmp_node.parent_page_ = -1;
-        tmp_node.keys_.push_back(key);
-        tmp_node.values_.push_back(value);
-        root_ = tmp_node.page_id_;
-        return;
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class IT>
+page_id_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::build_sorted(IT first, IT last,
+                                                                     double fill_factor) {
+    int fanout =
+        std::min(INTERNAL_CAPACITY + 1, std::max(3, int(fill_factor * (INTERNAL_CAPACITY + 1))));
+
+    // Firstly, pack the leaves from left to right
+    std::vector<std::pair<KT, page_id_t>> level;  // first key and page of each node
+    std::vector<int> counts;                      // and records under it
+    node_handle cur_node;
+    for (; first != last; ++first) {
+        const KT &key = first->first;
+        if (cur_node && key < cur_node->keys_.back()) {
+            throw std::invalid_argument("bulk_load: keys are not sorted");
+        }
+        if (!cur_node ||
+            cur_node->key_num_ >=
+                std::max(1, int(fill_factor * node_t::leaf_limit(cur_node->keys_.front(), key)))) {
+            node_handle leaf = new_node();
+            leaf->is_leaf_ = true;
+            if (cur_node) {
+                cur_node->next_page_ = leaf.page_id();
+                leaf->prev_page_ = cur_node.page_id();
+            }
+            level.emplace_back(key, leaf.page_id());
+            counts.push_back(0);
+            cur_node = std::move(leaf);
+        }
+        cur_node->keys_.emplace_back(key);
+        cur_node->values_.emplace_back(first->second);
+        cur_node->key_num_++;
+        counts.back()++;
     }
-    page_id_t cur_page_id = root_;
-    page_id_t par_page_id = 0;
-    bpnode<KT, VT, ORDER> cur_node = bpnode<KT, VT, ORDER>(cur_page_id, folder_name_);
-    // get the leaf node
-    while (!cur_node.is_leaf_) {
-        par_page_id = cur_page_id;
-        cur_page_id =
-            cur_node.sub_ptrs_[std::upper_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key) -
-                               cur_node.keys_.begin()];
-        // std::cout << cur_page_id << std::endl;   // DEBUG
-        cur_node = bpnode<KT, VT, ORDER>(cur_page_id, folder_name_);
+    cur_node.release();
+    if (level.empty()) {
+        return -1;  // nothing to load
     }
 
-    // insert key-value
-    int key_pos = std::upper_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key) -
-                  cur_node.keys_.begin();
-    cur_node.keys_.insert(cur_node.keys_.begin() + key_pos, key);
-    cur_node.values_.insert(cur_node.values_.begin() + key_pos, value);
-    cur_node.key_num_++;
-    if (cur_node.key_num_ >= get_max_leaf_node_limit()) {
-        // NOW we have to split the nodes
-        bpnode<KT, VT, ORDER> new_node = bpnode<KT, VT, ORDER>(++page_id_counter_, folder_name_);
-        new_node.keys_ = std::vector<KT>(
-            cur_node.keys_.begin() + ceil(get_max_leaf_node_limit() / 2), cur_node.keys_.end());
-        new_node.values_ = std::vector<VT>(
-            cur_node.values_.begin() + ceil(get_max_leaf_node_limit() / 2), cur_node.values_.end());
-        new_node.is_leaf_ = true;
-        new_node.key_num_ = new_node.keys_.size();
-        new_node.parent_page_ = cur_node.parent_page_;
-        new_node.next_page_ = cur_node.next_page_;
-        new_node.prev_page_ = cur_node.page_id_;
-        cur_node.next_page_ = new_node.page_id_;
-        if (new_node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> tmp_node =
-                bpnode<KT, VT, ORDER>(new_node.next_page_, folder_name_);
-            tmp_node.prev_page_ = new_node.page_id_;
-        }
-        cur_node.keys_.resize(floor(get_max_leaf_node_limit() / 2));
-        cur_node.values_.resize(floor(get_max_leaf_node_limit() / 2));
-        cur_node.key_num_ = cur_node.keys_.size();
-        // update the parent node
-        if (cur_page_id == root_) {  // cur_node is the root node
-            // create a new root
-            bpnode<KT, VT, ORDER> new_root =
-                bpnode<KT, VT, ORDER>(++page_id_counter_, folder_name_);
-            new_root.is_leaf_ = false;
-            new_root.key_num_ = 1;
-            new_root.keys_.emplace_back(new_node.keys_[0]);
-            new_root.sub_ptrs_.emplace_back(cur_node.page_id_);
-            new_root.sub_ptrs_.emplace_back(new_node.page_id_);
-            new_root.parent_page_ = -1;
-            new_root.next_page_ = -1;
-            new_root.prev_page_ = -1;
-            root_ = new_root.page_id_;
-            // update child's parent
-            cur_node.parent_page_ = new_root.page_id_;
-            new_node.parent_page_ = new_root.page_id_;
-        } else {  // cur_node is the internal node
-            // insert new key in parent node
-            insert_update_parent(par_page_id, new_node.page_id_,
-                                 new_node.keys_[0]);  // recursion
+    // Secondly, build the internal levels until there is only the root
+    while (level.size() > 1) {
+        std::vector<std::pair<KT, page_id_t>> upper;
+        std::vector<int> upper_counts;
+        std::size_t node_num = (level.size() + fanout - 1) / fanout;
+        for (std::size_t i = 0; i < node_num; ++i) {
+            // spread children evenly, so that no node is left with one child
+            std::size_t st = level.size() * i / node_num;
+            std::size_t ed = level.size() * (i + 1) / node_num;
+            node_handle node = new_node();
+            node->is_leaf_ = false;
+            for (std::size_t j = st; j < ed; ++j) {
+                if (j > st) {
+                    node->keys_.emplace_back(level[j].first);
+                }
+                node->sub_ptrs_.emplace_back(level[j].second);
+                if constexpr (COUNTS) {
+                    node->counts_.emplace_back(counts[j]);
+                }
+            }
+            node->key_num_ = node->keys_.size();
+            upper.emplace_back(level[st].first, node.page_id());
+            upper_counts.push_back(
+                std::accumulate(counts.begin() + st, counts.begin() + ed, 0));
+        }
+        level.swap(upper);
+        counts.swap(upper_counts);
+    }
+    return level[0].second;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::compact(double fill_factor) {
+    if (fill_factor <= 0 || fill_factor > 1) {
+        throw std::invalid_argument("compact: fill_factor should be in (0, 1]");
+    }
+    std::unique_lock<std::shared_mutex> lock(tree_latch_);  // writers wait, readers go on
+
+    // Firstly, read the records out, level by level down to the leaves in key
+    // order. Nobody changes the tree meanwhile.
+    std::vector<std::pair<KT, VT>> records;
+    std::vector<page_id_t> pages;
+    if (root_ != -1) {
+        pages.push_back(root_);
+    }
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        node_handle node = pool_.fetch(pages[i], latch_shared);
+        if (!node->is_leaf_) {
+            pages.insert(pages.end(), node->sub_ptrs_.begin(), node->sub_ptrs_.end());
+            continue;
+        }
+        for (int j = 0; j < node->key_num_; ++j) {
+            records.emplace_back(node->keys_[j], node->values_[j]);
+        }
+    }
+
+    // Secondly, build a copy past the end of the file and publish it, the old
+    // tree is still whole on disk until the meta page (or the checkpoint) says
+    // otherwise. Its free list goes: those pages may take the copy below, and
+    // after a crash in between they are only lost space.
+    page_id_t old_counter = page_id_counter_;
+    free_pages_.clear();
+    pending_free_.clear();
+    page_id_t root = build_sorted(records.begin(), records.end(), fill_factor);
+    page_id_t copy_pages = page_id_counter_ - old_counter;
+    node_handle old_root = publish_root(root);
+    flush_locked();  // before a page of the old tree is touched
+    retire(std::move(old_root));
+
+    // Thirdly, every page up to old_counter is free now, copy the tree again
+    // into the first ones and retire the first copy, which lies past them.
+    // With a lower fill_factor the tree may not fit, then they are free pages.
+    if (copy_pages > old_counter) {
+        std::lock_guard<std::mutex> page_lock(page_mutex_);
+        for (page_id_t page_id = 1; page_id <= old_counter; ++page_id) {
+            add_free_page(page_id);
+        }
+    } else {
+        page_id_counter_ = 0;
+        root = build_sorted(records.begin(), records.end(), fill_factor);
+        old_root = publish_root(root);
+        flush_locked();
+        retire(std::move(old_root));
+    }
+    flush_locked();
+    store_.truncate(page_id_counter_ + 1);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_handle
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::publish_root(page_id_t root) {
+    std::unique_lock<rw_latch> root_lock(root_latch_);  // new descents wait here
+    node_handle old_root;
+    if (root_ != -1) {
+        old_root = pool_.fetch(root_, latch_exclusive);
+    }
+    root_ = root;
+    return old_root;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::retire(node_handle old_root) {
+    // Each node is latched exclusively once, top-down, so readers already
+    // inside finish first, and each leaf is left empty (dirty, so it stays
+    // empty if evicted), so cursors that come back find it dead and seek again.
+    std::vector<page_id_t> pages;
+    if (old_root) {
+        pages.push_back(old_root.page_id());
+    }
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        node_handle node = i == 0 ? std::move(old_root) : pool_.fetch(pages[i], latch_exclusive);
+        if (!node->is_leaf_) {
+            if (latest_snapshot_.load(std::memory_order_relaxed) != 0) {
+                keep_version(node);  // the page is reused later
+            }
+            pages.insert(pages.end(), node->sub_ptrs_.begin(), node->sub_ptrs_.end());
+            continue;
         }
+        before_change(node);
+        node->keys_.clear();
+        node->values_.clear();
+        node->key_num_ = 0;
+    }
+    for (page_id_t page_id : pages) {
+        pool_.discard(page_id);
     }
+    std::unique_lock<std::shared_mutex> filter_lock(filter_mutex_);
+    filters_.clear();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::bulk_load(
+    std::vector<std::pair<KT, VT>> records, double fill_factor) {
+    std::stable_sort(records.begin(), records.end(),
+                     [](const std::pair<KT, VT> &a, const std::pair<KT, VT> &b) {
+                         return a.first < b.first;
+                     });
+    bulk_load(records.begin(), records.end(), fill_factor);
 }
 
-template <class KT, class VT, std::size_t ORDER>
-void bptree<KT, VT, ORDER>::insert_update_parent(page_id_t par_page_id, page_id_t new_page_id,
-                                                 KT key) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::insert_update_parent(
+    std::vector<node_handle> &path, page_id_t new_page_id, KT key, int count, SPLIT_KIND kind) {
     // Note:
-    // VThis function works when the child node is splitted,
-    // par_page_id denotes the parent node of the left-splitted child,
+    // This function works when the child node is splitted,
+    // path.back() denotes the parent node of the left-splitted child,
     // new_page_id denotes the right-splitted child
     // key denotes the key value of right sib.
     // (It works when split the internal nodes)
-    bpnode<KT, VT, ORDER> par_node = bpnode<KT, VT, ORDER>(par_page_id, folder_name_);
-    int key_pos = std::upper_bound(par_node.keys_.begin(), par_node.keys_.end(), key) -
-                  par_node.keys_.begin();
-    par_node.keys_.insert(par_node.keys_.begin() + key_pos, key);
-    par_node.sub_ptrs_.insert(par_node.sub_ptrs_.begin() + key_pos + 1, new_page_id);
-    par_node.key_num_++;
-    if (par_node.key_num_ >= get_max_internal_node_limit()) {
-        // SPLIIIIIVT
-        // NOVTE Behavior wrong!!!!
-        // VTO[x]DO: Debug
+    // path is latched, and it goes up to a node that will not split
+    node_handle par_node = std::move(path.back());
+    path.pop_back();
+    before_change(par_node);
+    int key_pos = par_node->upper_bound(key);
+    par_node->keys_.insert(par_node->keys_.begin() + key_pos, key);
+    par_node->sub_ptrs_.insert(par_node->sub_ptrs_.begin() + key_pos + 1, new_page_id);
+    if constexpr (COUNTS) {
+        par_node->counts_[key_pos] -= count;
+        par_node->counts_.insert(par_node->counts_.begin() + key_pos + 1, count);
+    }
+    par_node->key_num_++;
+    if (par_node->overflow()) {
+        // SPLIT
         // 3 5 7 9
         //    7
         //  ↙  ↘
@@ -208,355 +2038,856 @@ void bptree<KT, VT, ORDER>::insert_update_parent(page_id_t par_page_id, page_id_
         // 7 as a new value, add to it's parent.
         // if it doesn't have parent? it become a new parent node.
 
-        // Firstly, SPLIVT
-        bpnode<KT, VT, ORDER> right_sib_node =
-            bpnode<KT, VT, ORDER>(++page_id_counter_, folder_name_);
-        right_sib_node.keys_ =
-            std::vector<KT>(par_node.keys_.begin() + floor(get_max_internal_node_limit() / 2 + 1),
-                            par_node.keys_.end());
-        right_sib_node.sub_ptrs_ = std::vector<page_id_t>(
-            par_node.sub_ptrs_.begin() + floor(get_max_internal_node_limit() / 2 + 1),
-            par_node.sub_ptrs_.end());
-        right_sib_node.key_num_ = right_sib_node.keys_.size();
-        right_sib_node.parent_page_ = par_node.parent_page_;
-        right_sib_node.next_page_ = par_node.next_page_;
-        right_sib_node.prev_page_ = par_node.page_id_;
-        if (right_sib_node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> tmp_node =
-                bpnode<KT, VT, ORDER>(right_sib_node.next_page_, folder_name_);
-            tmp_node.prev_page_ = right_sib_node.page_id_;
+        // Firstly, SPLIT. At an edge, the side away from the new key keeps all
+        // but one key (an internal node needs one key at least).
+        kind = split_kind(*par_node, key_pos, kind);
+        int mid = kind == split_append    ? par_node->key_num_ - 2
+                  : kind == split_prepend ? 1
+                                          : par_node->key_num_ / 2;
+        node_handle right_sib_node = new_node();
+        right_sib_node->keys_.assign(par_node->keys_.begin() + mid + 1, par_node->keys_.end());
+        right_sib_node->sub_ptrs_.assign(par_node->sub_ptrs_.begin() + mid + 1,
+                                         par_node->sub_ptrs_.end());
+        right_sib_node->key_num_ = right_sib_node->keys_.size();
+        if constexpr (COUNTS) {
+            right_sib_node->counts_.assign(par_node->counts_.begin() + mid + 1,
+                                           par_node->counts_.end());
+            par_node->counts_.resize(mid + 1);
         }
         // Get the '7' in example
-        auto add_key = par_node.keys_[floor(get_max_internal_node_limit() / 2)];
+        auto add_key = par_node->keys_[mid];
         // resize the previous parent
-        par_node.next_page_ = right_sib_node.page_id_;
-        par_node.keys_.resize(floor(get_max_internal_node_limit() / 2));
-        par_node.sub_ptrs_.resize(floor(get_max_internal_node_limit() / 2) + 1);
-        par_node.key_num_ = par_node.keys_.size();
+        // (internal nodes are not chained, nothing walks them sideways)
+        par_node->keys_.resize(mid);
+        par_node->sub_ptrs_.resize(mid + 1);
+        par_node->key_num_ = par_node->keys_.size();
 
-        // Secondly, UPDAVTE PARENVT!
-        if (par_page_id == root_) {  // par_node is the root node
+        // Secondly, UPDATE PARENT!
+        int right_count = COUNTS ? right_sib_node->record_count() : 0;
+        if (path.empty()) {  // par_node is the root node, root_lock is held
             // create a new root
-            auto new_root = bpnode<KT, VT, ORDER>(++page_id_counter_, folder_name_);
-            new_root.is_leaf_ = false;
-            new_root.key_num_ = 1;
-            new_root.keys_.emplace_back(add_key);
-            new_root.sub_ptrs_.emplace_back(par_node.page_id_);
-            new_root.sub_ptrs_.emplace_back(right_sib_node.page_id_);
-            new_root.parent_page_ = -1;
-            new_root.next_page_ = -1;
-            new_root.prev_page_ = -1;
-            root_ = new_root.page_id_;
-            // update child's parent
-            par_node.parent_page_ = new_root.page_id_;
-            right_sib_node.parent_page_ = new_root.page_id_;
+            grow_root(par_node.page_id(), right_sib_node.page_id(), add_key,
+                      COUNTS ? par_node->record_count() : 0, right_count);
         } else {  // par_node is the internal node
             // insert new key in parent node
-            insert_update_parent(par_node.parent_page_, right_sib_node.page_id_,
-                                 add_key);  // recursion AGAIN!
+            page_id_t right_page_id = right_sib_node.page_id();
+            par_node.release();
+            right_sib_node.release();
+            // recursion AGAIN!
+            insert_update_parent(path, right_page_id, add_key, right_count, kind);
+        }
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::grow_root(
+    page_id_t left, page_id_t right, KT key, int left_count, int right_count) {
+    node_handle new_root = new_node();
+    new_root->is_leaf_ = false;
+    new_root->key_num_ = 1;
+    new_root->keys_.emplace_back(key);
+    new_root->sub_ptrs_.emplace_back(left);
+    new_root->sub_ptrs_.emplace_back(right);
+    if constexpr (COUNTS) {
+        new_root->counts_.emplace_back(left_count);
+        new_root->counts_.emplace_back(right_count);
+    }
+    new_root->next_page_ = -1;
+    new_root->prev_page_ = -1;
+    root_ = new_root.page_id();
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class FUNC>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::range_search(
+    KT key_start, KT key_end, FUNC &func, int mode) {
+    bool changed = false;
+    uint64_t lsn = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_latch_);
+        range_walk(
+            key_start, key_end,
+            [&](node_handle &leaf, int pos) { return edit_value(leaf, pos, func, changed, lsn); },
+            mode, latch_exclusive);
+    }
+    if (changed) {
+        end_op(lsn);
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class FUNC>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::range_read(KT key_start, KT key_end,
+                                                                          FUNC &func, int mode) {
+    range_walk(
+        key_start, key_end,
+        [&func](node_handle &leaf, int pos) {
+            const VT &value = leaf->values_[pos];
+            return call_visitor(func, value);
+        },
+        mode, latch_shared);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class VISIT>
+bool bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::lookup(KT key, LATCH_MODE mode,
+                                                                      VISIT &&visit) {
+    node_handle leaf = find_leaf(key, mode, true);
+    if (!leaf) {
+        return false;  // empty tree, or the filter knows
+    }
+    int pos = leaf->lower_bound(key);
+    if (pos < leaf->key_num_ && leaf->keys_[pos] == key) {
+        visit(leaf, pos);
+        return true;
+    }
+    // a miss that went all the way down, the next one may not need to
+    filter_build(leaf);
+    return false;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::optional<VT> bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::find(KT key) {
+    std::optional<VT> value;
+    lookup(key, latch_shared, [&](node_handle &leaf, int pos) { value = leaf->values_[pos]; });
+    return value;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+bool bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::contains(KT key) {
+    return lookup(key, latch_shared, [](node_handle &, int) {});
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class FUNC>
+bool bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::update(KT key, FUNC &&func) {
+    bool found;
+    bool changed = false;
+    uint64_t lsn = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_latch_);
+        found = lookup(key, latch_exclusive, [&](node_handle &leaf, int pos) {
+            edit_value(leaf, pos, func, changed, lsn);
+        });
+    }
+    if (changed) {
+        end_op(lsn);
+    }
+    return found;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class VISIT>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::multi_walk(
+    const std::vector<KT> &keys, LATCH_MODE mode, VISIT &&visit) {
+    std::size_t found = 0;
+    std::size_t i = 0;
+    while (i < keys.size()) {
+        // Go down for keys[i]. The smallest separator right of the way down is
+        // where the leaf ends, it can only grow while we hold the leaf. (A retry
+        // when optimistic only makes it smaller, so we just go down more often.)
+        std::optional<KT> fence;
+        auto choose = [&](const node_t &node) {
+            int pos = node.upper_bound(keys[i]);
+            if (pos < node.key_num_ && (!fence || node.keys_[pos] < *fence)) {
+                fence = node.keys_[pos];
+            }
+            return pos;
+        };
+        node_handle leaf = find_leaf_by(choose, mode);
+        if (!leaf) {
+            break;  // empty tree
+        }
+        do {
+            int pos = leaf->lower_bound(keys[i]);
+            if (pos < leaf->key_num_ && leaf->keys_[pos] == keys[i]) {
+                found++;
+                if (!visit(leaf, pos, i)) {
+                    return found;
+                }
+            }
+            i++;
+        } while (i < keys.size() && (!fence || keys[i] < *fence));
+    }
+    return found;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::vector<std::optional<VT>> bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::multi_get(
+    const std::vector<KT> &keys) {
+    std::vector<KT> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    std::vector<std::optional<VT>> sorted_values(sorted.size());
+    multi_walk(sorted, latch_shared, [&](node_handle &leaf, int pos, std::size_t i) {
+        sorted_values[i] = leaf->values_[pos];
+        return true;
+    });
+    // back to the order asked in
+    std::vector<std::optional<VT>> values;
+    values.reserve(keys.size());
+    for (const KT &key : keys) {
+        values.push_back(
+            sorted_values[std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin()]);
+    }
+    return values;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class FUNC>
+std::size_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::multi_update(
+    std::vector<KT> keys, FUNC &&func) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::size_t found;
+    bool changed = false;
+    uint64_t lsn = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_latch_);
+        found = multi_walk(keys, latch_exclusive, [&](node_handle &leaf, int pos, std::size_t) {
+            return edit_value(leaf, pos, func, changed, lsn);
+        });
+    }
+    if (changed) {
+        end_op(lsn);
+    }
+    return found;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class T, class FOLD, class MERGE>
+T bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::parallel_scan(
+    KT st, KT ed, FOLD &&fold, MERGE &&merge, bool ordered, unsigned threads) {
+    return scan_parts<T>(st, ed, fold, merge, ordered, threads,
+                         [this](const KT &start, auto &&visit) {
+                             walk_from(start, [&](node_handle &leaf, int pos) {
+                                 return visit(*leaf, pos);
+                             });
+                         });
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class T, class FOLD, class MERGE, class WALK>
+T bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::scan_parts(
+    KT st, KT ed, FOLD &fold, MERGE &merge, bool ordered, unsigned threads, WALK &&walk) {
+    if (ed < st) {
+        throw std::invalid_argument("parallel_scan: ed < st");
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // a few parts per thread, so that one slow part does not hold the rest
+    std::vector<KT> bounds = split_range(st, ed, std::size_t(threads) * 4);
+    bounds.insert(bounds.begin(), st);
+    std::size_t part_num = bounds.size();
+    threads = std::min<std::size_t>(threads, part_num);
+
+    std::vector<T> parts(part_num);
+    std::vector<bool> done(part_num, false);
+    std::vector<std::size_t> finished;  // done and not merged yet, for !ordered
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::exception_ptr error;
+    std::size_t next_part = 0;  // guarded by mutex
+
+    auto worker = [&] {
+        while (true) {
+            std::size_t i;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (next_part == part_num || error) {
+                    return;
+                }
+                i = next_part++;
+            }
+            try {
+                // parts are [bounds[i], bounds[i + 1]), the last one ends at ed
+                bool last = i + 1 == part_num;
+                walk(bounds[i], [&](const node_t &leaf, int pos) {
+                    const KT &key = leaf.keys_[pos];
+                    if (last ? ed < key : !(key < bounds[i + 1])) {
+                        return false;
+                    }
+                    fold(parts[i], key, leaf.values_[pos]);
+                    return true;
+                });
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done[i] = true;
+                finished.push_back(i);
+            }
+            ready.notify_one();
+        }
+    };
+    std::vector<std::thread> pool;
+    if (threads == 1) {
+        worker();  // nothing to wait for
+    } else {
+        for (unsigned t = 0; t < threads; ++t) {
+            pool.emplace_back(worker);
+        }
+    }
+
+    // merge on this thread while the others go on
+    T result = T();
+    try {
+        for (std::size_t merged = 0; merged < part_num; ++merged) {
+            std::size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] {
+                    return error || (ordered ? done[merged] : merged < finished.size());
+                });
+                if (error) {
+                    break;
+                }
+                i = ordered ? merged : finished[merged];
+            }
+            merge(result, std::move(parts[i]));
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+    for (std::thread &t : pool) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return result;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+std::vector<KT> bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::split_range(
+    const KT &st, const KT &ed, std::size_t parts) {
+    // Note:
+    // Subtrees of one level hold about as many leaves, so their separators cut
+    // the range evenly. The root's children are read while the root is latched,
+    // like a reader going down, the cuts are only a hint anyway.
+    std::vector<KT> seps;
+    std::shared_lock<rw_latch> root_lock(root_latch_);
+    if (root_ == -1 || parts < 2) {
+        return seps;
+    }
+    node_handle root = pool_.fetch(root_, latch_shared);
+    root_lock.unlock();
+    auto add_seps = [&](const node_t &node) {
+        for (int i = node.upper_bound(st); i < node.key_num_ && !(ed < node.keys_[i]); ++i) {
+            seps.push_back(node.keys_[i]);
+        }
+    };
+    if (root->is_leaf_) {
+        return seps;
+    }
+    add_seps(*root);
+    if (seps.size() + 1 < parts) {
+        // too few, take those of the children too (all children are of one height)
+        int first = root->upper_bound(st);
+        int last = root->upper_bound(ed);
+        std::vector<KT> root_seps;
+        root_seps.swap(seps);
+        for (int i = first; i <= last; ++i) {
+            node_handle child = pool_.fetch(root->sub_ptrs_[i], latch_shared);
+            if (child->is_leaf_) {
+                seps.swap(root_seps);
+                break;
+            }
+            if (i > first) {
+                seps.push_back(root->keys_[i - 1]);
+            }
+            add_seps(*child);
+        }
+    }
+    if (seps.size() + 1 <= parts) {
+        return seps;
+    }
+    std::vector<KT> bounds;
+    for (std::size_t i = 1; i < parts; ++i) {
+        bounds.push_back(seps[i * seps.size() / parts]);
+    }
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    return bounds;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class VISIT>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::walk_from(
+    const KT &key_start, VISIT &&visit) {
+    node_handle leaf = find_leaf(key_start, latch_shared);
+    if (!leaf) {
+        return;
+    }
+    int pos = leaf->lower_bound(key_start);
+    int ahead = 0;
+    while (true) {
+        read_ahead(leaf, ahead);
+        for (; pos < leaf->key_num_; ++pos) {
+            if (!visit(leaf, pos)) {
+                return;
+            }
+        }
+        if (leaf->next_page_ == -1) {
+            return;
+        }
+        // latch the next leaf before letting this one go, left to right
+        leaf = pool_.fetch(leaf->next_page_, latch_shared);
+        pos = 0;
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::snapshot
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::take_snapshot() {
+    // no writer is half way through, so root_ and the pages are of one moment,
+    // and the writers after it see latest_snapshot_
+    std::unique_lock<std::shared_mutex> lock(tree_latch_);
+    std::lock_guard<std::mutex> version_lock(version_mutex_);
+    uint64_t epoch = ++epoch_;
+    snapshots_.insert(epoch);
+    latest_snapshot_ = epoch;
+    return snapshot(this, epoch, root_);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+typename bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::node_view
+bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::view_node(page_id_t page_id,
+                                                                    uint64_t epoch) {
+    // Note:
+    // A writer keeps the version under the node latch before it changes the
+    // node, so with the live node latched shared either a version is there
+    // already or the live node is still the one of the snapshot.
+    auto kept = [&]() -> std::shared_ptr<const node_t> {
+        std::lock_guard<std::mutex> lock(version_mutex_);
+        auto it = versions_.find(page_id);
+        if (it == versions_.end()) {
+            return nullptr;
+        }
+        auto ver = std::lower_bound(
+            it->second.begin(), it->second.end(), epoch,
+            [](const typename version_list::value_type &v, uint64_t e) { return v.first < e; });
+        return ver == it->second.end() ? nullptr : ver->second;
+    };
+    node_view view;
+    view.kept = kept();  // most changed pages are found here, without a fetch
+    if (!view.kept) {
+        view.live = pool_.fetch(page_id, latch_shared);
+        view.kept = kept();
+        if (view.kept) {
+            view.live.release();
+        }
+    }
+    return view;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::keep_version(
+    const node_handle &node) {
+    std::lock_guard<std::mutex> lock(version_mutex_);
+    uint64_t latest = latest_snapshot_.load(std::memory_order_relaxed);
+    if (latest == 0) {
+        return;
+    }
+    version_list &list = versions_[node.page_id()];
+    if (list.empty() || list.back().first < latest) {
+        list.emplace_back(latest, std::make_shared<const node_t>(*node));
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::release_snapshot(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(version_mutex_);
+    snapshots_.erase(epoch);
+    if (snapshots_.empty()) {
+        latest_snapshot_ = 0;
+        versions_.clear();
+        return;
+    }
+    latest_snapshot_ = *snapshots_.rbegin();
+    // a version tagged t is read by the snapshots after the version before it, up to t
+    for (auto it = versions_.begin(); it != versions_.end();) {
+        version_list &list = it->second;
+        std::size_t n = 0;
+        uint64_t prev = 0;
+        for (std::size_t i = 0; i < list.size(); ++i) {
+            auto reader = snapshots_.upper_bound(prev);
+            prev = list[i].first;
+            if (reader != snapshots_.end() && *reader <= prev) {
+                if (n != i) {
+                    list[n] = std::move(list[i]);
+                }
+                n++;
+            }
+        }
+        list.resize(n);
+        it = list.empty() ? versions_.erase(it) : std::next(it);
+    }
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::set_leaf_filters(int bits_per_key) {
+    if (bits_per_key < 0) {
+        throw std::invalid_argument("set_leaf_filters: bits_per_key should not be negative");
+    }
+    std::unique_lock<std::shared_mutex> lock(filter_mutex_);
+    filters_.clear();
+    filter_bits_ = bits_per_key;
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::filter_build(
+    const node_handle &leaf) {
+    // Note:
+    // Writers add keys under the leaf latch, which we hold, so the filter
+    // misses nothing. A freed page drops its filter after the discard, so
+    // checking discarded() under filter_mutex_ keeps a filter from outliving
+    // its page, and a filter on an emptied leaf would be wrong once refilled.
+    int bits = filter_bits_.load(std::memory_order_relaxed);
+    if (bits == 0 || leaf->key_num_ == 0) {
+        return;
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(filter_mutex_);
+        if (filters_.count(leaf.page_id())) {
+            return;
         }
     }
+    // room for a full leaf, more keys than that only make it less sharp
+    auto filter = std::make_unique<bloom_filter>(
+        std::size_t(bits) * std::max(leaf->key_num_, LEAF_CAPACITY),
+        bloom_filter::best_hashes(bits));
+    for (int i = 0; i < leaf->key_num_; ++i) {
+        filter->add(bloom_filter::key_hash(leaf->keys_[i]));
+    }
+    std::unique_lock<std::shared_mutex> lock(filter_mutex_);
+    if (filter_bits_.load(std::memory_order_relaxed) == bits && !leaf.discarded()) {
+        filters_.emplace(leaf.page_id(), std::move(filter));
+    }
 }
 
-template <class KT, class VT, std::size_t ORDER>
-void bptree<KT, VT, ORDER>::range_search(KT key_start, KT key_end, std::function<void(VT &)> func,
-                                         int mode) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+template <class VISIT>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::range_walk(KT key_start, KT key_end,
+                                                                          VISIT &&visit, int mode,
+                                                                          LATCH_MODE leaf_mode) {
     // error handling
     if (key_end < key_start) {
         throw std::invalid_argument("search: key_end < key_start");
     }
-    if (root_ == -1) {
+    node_handle cur_node = find_leaf(key_start, leaf_mode);
+    if (!cur_node) {
         throw std::runtime_error("search: tree is empty!");
     }
-
-    bpnode<KT, VT, ORDER> cur_node = bpnode<KT, VT, ORDER>(root_, folder_name_);
-    while (!cur_node.is_leaf_) {
-        auto key_pos = std::upper_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key_start) -
-                       cur_node.keys_.begin();
-        cur_node = bpnode<KT, VT, ORDER>(cur_node.sub_ptrs_[key_pos], folder_name_);
-    }
     // Now, cur_node is the leaf node
     // Get the key position
-    auto key_pos = std::lower_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key_start) -
-                   cur_node.keys_.begin();
-    if (key_pos >= cur_node.key_num_ || cur_node.keys_[key_pos] < key_start) {
+    auto key_pos = cur_node->lower_bound(key_start);
+    // the first key may live in the next leaf
+    if (key_pos == cur_node->key_num_ && cur_node->next_page_ != -1) {
+        cur_node = pool_.fetch(cur_node->next_page_, leaf_mode);
+        key_pos = 0;
+    }
+    if (key_pos >= cur_node->key_num_ || key_end < cur_node->keys_[key_pos]) {
         throw std::runtime_error("search: key not found!");
     }
     if (mode == 1) {
-        func(cur_node.values_[key_pos]);
+        visit(cur_node, key_pos);
     } else {
         // Now we need a loop
-        while (cur_node.keys_[key_pos] <= key_end) {
-            func(cur_node.values_[key_pos]);
+        int ahead = 0;
+        if (cur_node->keys_.back() < key_end) {
+            read_ahead(cur_node, ahead);
+        }
+        while (cur_node->keys_[key_pos] <= key_end) {
+            if (!visit(cur_node, key_pos)) {
+                break;
+            }
             key_pos++;
             // go to next leaf
-            if (key_pos == cur_node.key_num_) {
+            if (key_pos == cur_node->key_num_) {
                 // loop til the end~~~
-                if (cur_node.next_page_ == -1) {
+                if (cur_node->next_page_ == -1) {
                     break;
                 }
-                cur_node = bpnode<KT, VT, ORDER>(cur_node.next_page_, folder_name_);
+                cur_node = pool_.fetch(cur_node->next_page_, leaf_mode);
                 key_pos = 0;
+                if (cur_node->key_num_ > 0 && cur_node->keys_.back() < key_end) {
+                    read_ahead(cur_node, ahead);
+                }
             }
         }
     }
 }
 
-template <class KT, class VT, std::size_t ORDER>
-void bptree<KT, VT, ORDER>::remove(KT key) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::remove(KT key) {
+    uint64_t lsn;
+    {
+        std::shared_lock<std::shared_mutex> lock(tree_latch_);
+        lsn = remove_one(key);
+    }
+    end_op(lsn);
+}
+
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+uint64_t bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::remove_one(KT key) {
     // Note
-    // [] VTODO
-    // Here is sth wrong with the delete method...
-    // especially at the merge part
-    // if we merge to left sibling, the parent key change may be complicated
+    // Siblings are taken from the same parent, so the parent key change
+    // is just the separator between them.
 
+    // get the leaf node, and the nodes above if it goes empty
+    std::vector<node_handle> path;
+    std::unique_lock<rw_latch> root_lock(root_latch_, std::defer_lock);
+    node_handle cur_node = write_leaf(key, write_remove, path, root_lock);
     // error handling
-    if (root_ == -1) {
+    if (!cur_node) {
         throw std::runtime_error("remove: tree is empty!");
     }
-
-    bpnode<KT, VT, ORDER> cur_node = bpnode<KT, VT, ORDER>(root_, folder_name_);
-    while (!cur_node.is_leaf_) {
-        auto key_pos = std::upper_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key) -
-                       cur_node.keys_.begin();
-        cur_node = bpnode<KT, VT, ORDER>(cur_node.sub_ptrs_[key_pos], folder_name_);
-    }
     // Now, cur_node is the leaf node
     // Get the key position
-    auto key_pos = std::lower_bound(cur_node.keys_.begin(), cur_node.keys_.end(), key) -
-                   cur_node.keys_.begin();
-    if (key_pos >= cur_node.key_num_ || cur_node.keys_[key_pos] != key) {
+    auto key_pos = cur_node->lower_bound(key);
+    if (key_pos >= cur_node->key_num_ || cur_node->keys_[key_pos] != key) {
         throw std::runtime_error("remove: key not found!");
     }
+    node_handle left_sibling;
+    node_handle right_sibling;
+    if (cur_node->key_num_ == 1 && !path.empty()) {
+        // It goes empty, so we need its neighbours on the leaf chain, latched from
+        // left to right like readers walk: let it go, latch the left one, latch it
+        // again and check the left one is still its left one. Nobody else can
+        // change it meanwhile, the parent is ours.
+        while (cur_node->prev_page_ != -1) {
+            page_id_t prev_id = cur_node->prev_page_;
+            cur_node.unlatch();
+            left_sibling = pool_.fetch(prev_id, latch_exclusive);
+            cur_node.latch(latch_exclusive);
+            if (cur_node->prev_page_ == prev_id && !left_sibling.discarded()) {
+                break;
+            }
+            left_sibling.release();
+        }
+        if (cur_node->next_page_ != -1) {
+            right_sibling = pool_.fetch(cur_node->next_page_, latch_exclusive);
+        }
+    }
     // Now, we can remove the key
-    auto tmp_front_key = cur_node.keys_.front();  // record the front first~
-    cur_node.keys_.erase(cur_node.keys_.begin() + key_pos);
-    cur_node.values_.erase(cur_node.values_.begin() + key_pos);
-    cur_node.key_num_--;
+    before_change(cur_node);
+    cur_node->keys_.erase(cur_node->keys_.begin() + key_pos);
+    cur_node->values_.erase(cur_node->values_.begin() + key_pos);
+    cur_node->key_num_--;
+    count_path(path, key, -1);
+    uint64_t lsn = log_record(wal_remove, key);
     // balance! note that here set zero for balance.
     // cuz in the file system we may spend more time on data stealing
-    if (cur_node.key_num_ == 0) {
-        // steal from left sibling
-        if (cur_node.prev_page_ != -1) {
-            bpnode<KT, VT, ORDER> left_sibling =
-                bpnode<KT, VT, ORDER>(cur_node.prev_page_, folder_name_);
-            if (left_sibling.key_num_ >= ceil(get_max_leaf_node_limit() / 2)) {
-                // transfer the maximum keys from the left sibling
-                cur_node.keys_.emplace(cur_node.keys_.begin(), left_sibling.keys_.back());
-                cur_node.values_.emplace(cur_node.values_.begin(), left_sibling.values_.back());
-                cur_node.key_num_++;
-                left_sibling.keys_.pop_back();
-                left_sibling.values_.pop_back();
-                left_sibling.key_num_--;
-                // update parent
-                if (cur_node.parent_page_ != -1) {
-                    bpnode<KT, VT, ORDER> par_node =
-                        bpnode<KT, VT, ORDER>(cur_node.parent_page_, folder_name_);
-                    auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                                    tmp_front_key) -
-                                   par_node.keys_.begin();
-                    par_node.keys_[key_pos] = cur_node.keys_.front();
-                }
-                return;
-            }
-        }
-        // steal from right sibling
-        if (cur_node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> right_sibling =
-                bpnode<KT, VT, ORDER>(cur_node.next_page_, folder_name_);
-            if (right_sibling.key_num_ >= ceil(get_max_leaf_node_limit() / 2)) {
-                // transfer the minimum keys from the right sibling
-                tmp_front_key = right_sibling.keys_.front();
-                cur_node.keys_.emplace_back(right_sibling.keys_.front());
-                cur_node.values_.emplace_back(right_sibling.values_.front());
-                cur_node.key_num_++;
-                right_sibling.keys_.erase(right_sibling.keys_.begin());
-                right_sibling.values_.erase(right_sibling.values_.begin());
-                right_sibling.key_num_--;
-                // update parent
-                if (cur_node.parent_page_ != -1) {
-                    bpnode<KT, VT, ORDER> par_node =
-                        bpnode<KT, VT, ORDER>(cur_node.parent_page_, folder_name_);
-                    auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                                    tmp_front_key) -
-                                   par_node.keys_.begin();
-                    par_node.keys_[key_pos] = right_sibling.keys_.front();
-                }
-                return;
+    if (cur_node->key_num_ > 0) {
+        return lsn;
+    }
+    if (path.empty()) {  // the last key of the tree, root_lock is held
+        free_node(cur_node);
+        root_ = -1;
+        return lsn;
+    }
+    node_handle par_node = std::move(path.back());
+    path.pop_back();
+    int child_pos = std::find(par_node->sub_ptrs_.begin(), par_node->sub_ptrs_.end(),
+                              cur_node.page_id()) -
+                    par_node->sub_ptrs_.begin();
+    // the chain neighbours are siblings if they have the same parent
+    // steal from left sibling
+    if (child_pos > 0) {
+        if (left_sibling->key_num_ >= (LEAF_CAPACITY + 1) / 2) {
+            // transfer the maximum keys from the left sibling
+            before_change(left_sibling);
+            before_change(par_node);
+            cur_node->keys_.emplace(cur_node->keys_.begin(), left_sibling->keys_.back());
+            cur_node->values_.emplace(cur_node->values_.begin(), left_sibling->values_.back());
+            cur_node->key_num_++;
+            filter_add(cur_node, cur_node->keys_.front());
+            left_sibling->keys_.pop_back();
+            left_sibling->values_.pop_back();
+            left_sibling->key_num_--;
+            // update parent
+            par_node->keys_[child_pos - 1] = cur_node->keys_.front();
+            if constexpr (COUNTS) {
+                par_node->counts_[child_pos - 1]--;
+                par_node->counts_[child_pos]++;
             }
+            return lsn;
         }
-        // merge with left sibling
-        if (cur_node.prev_page_ != -1) {
-            bpnode<KT, VT, ORDER> left_sibling =
-                bpnode<KT, VT, ORDER>(cur_node.prev_page_, folder_name_);
-            // mark
-            tmp_front_key = cur_node.keys_.front();
-            // merge
-            left_sibling.keys_.insert(left_sibling.keys_.end(), cur_node.keys_.begin(),
-                                      cur_node.keys_.end());
-            left_sibling.values_.insert(left_sibling.values_.end(), cur_node.values_.begin(),
-                                        cur_node.values_.end());
-            left_sibling.key_num_ += cur_node.key_num_;
-            left_sibling.next_page_ = cur_node.next_page_;
-            if (cur_node.next_page_ != -1) {
-                bpnode<KT, VT, ORDER> next_node =
-                    bpnode<KT, VT, ORDER>(cur_node.next_page_, folder_name_);
-                next_node.prev_page_ = cur_node.prev_page_;
-            }
-            cur_node.key_num_ = 0;  // clear, and destruct later
-            // update parent
-            bpnode<KT, VT, ORDER> par_node =
-                bpnode<KT, VT, ORDER>(cur_node.parent_page_, folder_name_);
-            // parent is the root
-            auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(), key) -
-                           par_node.keys_.begin();
-            par_node.keys_.erase(par_node.keys_.begin() + key_pos);
-            par_node.sub_ptrs_.erase(par_node.sub_ptrs_.begin() + key_pos + 1);
-            par_node.key_num_--;
-            if (par_node.key_num_ == 0) {
-                remove_update_parent(par_node, left_sibling.page_id_);
-            }
-        }  // merge with right sibling
-        else if (cur_node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> right_sibling =
-                bpnode<KT, VT, ORDER>(cur_node.next_page_, folder_name_);
-            // mark
-            tmp_front_key = right_sibling.keys_.front();
-            // merge
-            cur_node.keys_.insert(cur_node.keys_.end(), right_sibling.keys_.begin(),
-                                  right_sibling.keys_.end());
-            cur_node.values_.insert(cur_node.values_.end(), right_sibling.values_.begin(),
-                                    right_sibling.values_.end());
-            cur_node.key_num_ += right_sibling.key_num_;
-            cur_node.next_page_ = right_sibling.next_page_;
-            if (right_sibling.next_page_ != -1) {
-                bpnode<KT, VT, ORDER> next_node =
-                    bpnode<KT, VT, ORDER>(right_sibling.next_page_, folder_name_);
-                next_node.prev_page_ = cur_node.page_id_;
-            }
-            right_sibling.key_num_ = 0;  // clear, and destruct later
+    }
+    // steal from right sibling
+    if (child_pos < par_node->key_num_) {
+        if (right_sibling->key_num_ >= (LEAF_CAPACITY + 1) / 2) {
+            // transfer the minimum keys from the right sibling
+            before_change(right_sibling);
+            before_change(par_node);
+            cur_node->keys_.emplace_back(right_sibling->keys_.front());
+            cur_node->values_.emplace_back(right_sibling->values_.front());
+            cur_node->key_num_++;
+            filter_add(cur_node, cur_node->keys_.back());
+            right_sibling->keys_.erase(right_sibling->keys_.begin());
+            right_sibling->values_.erase(right_sibling->values_.begin());
+            right_sibling->key_num_--;
             // update parent
-            bpnode<KT, VT, ORDER> par_node =
-                bpnode<KT, VT, ORDER>(right_sibling.parent_page_, folder_name_);
-            // parent is the root
-            auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(), key) -
-                           par_node.keys_.begin();
-            par_node.keys_.erase(par_node.keys_.begin() + key_pos);
-            par_node.sub_ptrs_.erase(par_node.sub_ptrs_.begin() + key_pos + 1);
-            par_node.key_num_--;
-            if (par_node.key_num_ == 0) {
-                remove_update_parent(par_node, cur_node.page_id_);
+            par_node->keys_[child_pos] = right_sibling->keys_.front();
+            if constexpr (COUNTS) {
+                par_node->counts_[child_pos + 1]--;
+                par_node->counts_[child_pos]++;
             }
+            return lsn;
         }
     }
+    // merge, cur_node is empty so we just drop it
+    before_change(par_node);
+    if (child_pos > 0) {  // merge with left sibling
+        par_node->keys_.erase(par_node->keys_.begin() + child_pos - 1);
+    } else {  // merge with right sibling
+        par_node->keys_.erase(par_node->keys_.begin());
+    }
+    par_node->sub_ptrs_.erase(par_node->sub_ptrs_.begin() + child_pos);
+    if constexpr (COUNTS) {
+        par_node->counts_.erase(par_node->counts_.begin() + child_pos);  // it was 0
+    }
+    par_node->key_num_--;
+    // unlink it from the leaf chain
+    if (left_sibling) {
+        before_change(left_sibling);
+        left_sibling->next_page_ = cur_node->next_page_;
+    }
+    if (right_sibling) {
+        before_change(right_sibling);
+        right_sibling->prev_page_ = cur_node->prev_page_;
+    }
+    free_node(cur_node);
+    // no leaf stays latched while we go up: a reader in an uncle may wait for one
+    left_sibling.release();
+    right_sibling.release();
+    if (par_node->key_num_ == 0) {
+        remove_update_parent(par_node, path);
+    }
+    return lsn;
 }
 
-template <class KT, class VT, std::size_t ORDER>
-void bptree<KT, VT, ORDER>::remove_update_parent(bpnode<KT, VT, ORDER> &node,
-                                                 page_id_t child_page) {
+template <class KT, class VT, std::size_t PAGE_SIZE, bool PREFIX_KEYS, class LATCHING, bool COUNTS>
+void bptree<KT, VT, PAGE_SIZE, PREFIX_KEYS, LATCHING, COUNTS>::remove_update_parent(
+    node_handle &node, std::vector<node_handle> &path) {
     // Notes:
     // this works only for internal nodes
     //    5
     //   / \        kind of this situation, handled in previous part
     //  []  5*
-    // cur_node denotes the empty node now, next to handle steal or merge or sth~
+    // node denotes the internal node with no key (and one child) now,
+    // next to handle steal or merge or sth~
 
-    // Firstly, we handle the cur_page is root situation
-    if (node.page_id_ == root_) {
-        root_ = child_page;
+    // Firstly, we handle the cur_page is root situation (root_lock is held)
+    if (path.empty()) {
+        root_ = node->sub_ptrs_[0];
+        free_node(node);
         return;
     }
 
     // Secondly, we handle the cur_page is not root situation
-    bpnode<KT, VT, ORDER> &cur_node = node;
-    bpnode<KT, VT, ORDER> par_node = bpnode<KT, VT, ORDER>(node.parent_page_, folder_name_);
-    if (node.key_num_ == 0) {  // 100% VTrue, just for filed setting
-        // steal from left sibling
-        if (node.prev_page_ != -1) {
-            bpnode<KT, VT, ORDER> left_sibling =
-                bpnode<KT, VT, ORDER>(node.prev_page_, folder_name_);
-            if (left_sibling.key_num_ >= ceil(get_max_leaf_node_limit() / 2)) {
-                // steal
-                // search place
-                auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                                left_sibling.keys_.back()) -
-                               par_node.keys_.begin();
-                // key round
-                // Note: Here maybe some problems when cur_node is not empty
-                // but in this case cur_node must be empty :-)
-                cur_node.keys_.emplace(cur_node.keys_.begin(), par_node.keys_[key_pos]);
-                cur_node.key_num_++;
-                par_node.keys_[key_pos] = left_sibling.keys_.back();
-                left_sibling.keys_.pop_back();
-                left_sibling.key_num_--;
-                // ptr round
-                cur_node.sub_ptrs_.emplace(cur_node.sub_ptrs_.begin(),
-                                           left_sibling.sub_ptrs_.back());
-                left_sibling.sub_ptrs_.pop_back();
-                return;
+    // siblings are only reachable through par_node, which is ours
+    node_handle par_node = std::move(path.back());
+    path.pop_back();
+    int child_pos =
+        std::find(par_node->sub_ptrs_.begin(), par_node->sub_ptrs_.end(), node.page_id()) -
+        par_node->sub_ptrs_.begin();
+    // steal from left sibling
+    if (child_pos > 0) {
+        node_handle left_sibling = pool_.fetch(par_node->sub_ptrs_[child_pos - 1], latch_exclusive);
+        if (left_sibling->key_num_ >= (INTERNAL_CAPACITY + 1) / 2) {
+            before_change(node);
+            before_change(left_sibling);
+            before_change(par_node);
+            // key round
+            node->keys_.emplace(node->keys_.begin(), par_node->keys_[child_pos - 1]);
+            node->key_num_++;
+            par_node->keys_[child_pos - 1] = left_sibling->keys_.back();
+            left_sibling->keys_.pop_back();
+            left_sibling->key_num_--;
+            // ptr round
+            node->sub_ptrs_.emplace(node->sub_ptrs_.begin(), left_sibling->sub_ptrs_.back());
+            left_sibling->sub_ptrs_.pop_back();
+            if constexpr (COUNTS) {
+                int moved = left_sibling->counts_.back();
+                node->counts_.emplace(node->counts_.begin(), moved);
+                left_sibling->counts_.pop_back();
+                par_node->counts_[child_pos - 1] -= moved;
+                par_node->counts_[child_pos] += moved;
             }
+            return;
         }
-        // steal from right sibling
-        if (node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> right_sibling =
-                bpnode<KT, VT, ORDER>(node.next_page_, folder_name_);
-            if (right_sibling.key_num_ >= ceil(get_max_leaf_node_limit() / 2)) {
-                // steal
-                // search place
-                auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                                right_sibling.keys_.front()) -
-                               par_node.keys_.begin();
-                // key round
-                cur_node.keys_.emplace_back(par_node.keys_[key_pos]);
-                cur_node.key_num_++;
-                par_node.keys_[key_pos] = right_sibling.keys_.front();
-                right_sibling.keys_.erase(right_sibling.keys_.begin());
-                right_sibling.key_num_--;
-                // ptr round
-                cur_node.sub_ptrs_.emplace_back(right_sibling.sub_ptrs_.front());
-                right_sibling.sub_ptrs_.erase(right_sibling.sub_ptrs_.begin());
-                return;
+    }
+    // steal from right sibling
+    if (child_pos < par_node->key_num_) {
+        node_handle right_sibling =
+            pool_.fetch(par_node->sub_ptrs_[child_pos + 1], latch_exclusive);
+        if (right_sibling->key_num_ >= (INTERNAL_CAPACITY + 1) / 2) {
+            before_change(node);
+            before_change(right_sibling);
+            before_change(par_node);
+            // key round
+            node->keys_.emplace_back(par_node->keys_[child_pos]);
+            node->key_num_++;
+            par_node->keys_[child_pos] = right_sibling->keys_.front();
+            right_sibling->keys_.erase(right_sibling->keys_.begin());
+            right_sibling->key_num_--;
+            // ptr round
+            node->sub_ptrs_.emplace_back(right_sibling->sub_ptrs_.front());
+            right_sibling->sub_ptrs_.erase(right_sibling->sub_ptrs_.begin());
+            if constexpr (COUNTS) {
+                int moved = right_sibling->counts_.front();
+                node->counts_.emplace_back(moved);
+                right_sibling->counts_.erase(right_sibling->counts_.begin());
+                par_node->counts_[child_pos + 1] -= moved;
+                par_node->counts_[child_pos] += moved;
             }
+            return;
         }
-        // MERRRRRRRGE!!!!!
-        // merge with left sibling
-        if (node.prev_page_ != -1) {
-            bpnode<KT, VT, ORDER> left_sibling =
-                bpnode<KT, VT, ORDER>(node.prev_page_, folder_name_);
-            // merge
-            auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                            left_sibling.keys_.front()) -
-                           par_node.keys_.begin();
-            left_sibling.keys_.emplace_back(par_node.keys_[key_pos]);
-            left_sibling.key_num_++;
-            left_sibling.sub_ptrs_.emplace_back(child_page);
-            par_node.keys_.erase(par_node.keys_.begin() + key_pos);
-            par_node.sub_ptrs_.erase(par_node.sub_ptrs_.begin() + key_pos + 1);
-            par_node.key_num_--;
-            // update parent
-            if (par_node.key_num_ == 0) {
-                remove_update_parent(par_node, left_sibling.page_id_);
-            }
-        }
-        // merge with right sibling
-        else if (node.next_page_ != -1) {
-            bpnode<KT, VT, ORDER> right_sibling =
-                bpnode<KT, VT, ORDER>(node.next_page_, folder_name_);
-            // merge
-            auto key_pos = std::lower_bound(par_node.keys_.begin(), par_node.keys_.end(),
-                                            right_sibling.keys_.back()) -
-                           par_node.keys_.begin();
-            right_sibling.keys_.emplace(right_sibling.keys_.begin(), par_node.keys_[key_pos]);
-            right_sibling.key_num_++;
-            right_sibling.sub_ptrs_.emplace(right_sibling.sub_ptrs_.begin(), child_page);
-            par_node.keys_.erase(par_node.keys_.begin() + key_pos);
-            par_node.sub_ptrs_.erase(par_node.sub_ptrs_.begin() + key_pos);
-            par_node.key_num_--;
-            // update parent
-            if (par_node.key_num_ == 0) {
-                remove_update_parent(par_node, right_sibling.page_id_);
-            }
+    }
+    // MERRRRRRRGE!!!!!
+    before_change(par_node);
+    if (child_pos > 0) {  // merge with left sibling
+        node_handle left_sibling = pool_.fetch(par_node->sub_ptrs_[child_pos - 1], latch_exclusive);
+        before_change(left_sibling);
+        left_sibling->keys_.emplace_back(par_node->keys_[child_pos - 1]);
+        left_sibling->key_num_++;
+        left_sibling->sub_ptrs_.emplace_back(node->sub_ptrs_[0]);
+        if constexpr (COUNTS) {
+            left_sibling->counts_.emplace_back(node->counts_[0]);
+            par_node->counts_[child_pos - 1] += node->counts_[0];
+        }
+        par_node->keys_.erase(par_node->keys_.begin() + child_pos - 1);
+    } else {  // merge with right sibling
+        node_handle right_sibling =
+            pool_.fetch(par_node->sub_ptrs_[child_pos + 1], latch_exclusive);
+        before_change(right_sibling);
+        right_sibling->keys_.emplace(right_sibling->keys_.begin(), par_node->keys_[child_pos]);
+        right_sibling->key_num_++;
+        right_sibling->sub_ptrs_.emplace(right_sibling->sub_ptrs_.begin(), node->sub_ptrs_[0]);
+        if constexpr (COUNTS) {
+            right_sibling->counts_.emplace(right_sibling->counts_.begin(), node->counts_[0]);
+            par_node->counts_[child_pos + 1] += node->counts_[0];
         }
+        par_node->keys_.erase(par_node->keys_.begin() + child_pos);
+    }
+    par_node->sub_ptrs_.erase(par_node->sub_ptrs_.begin() + child_pos);
+    if constexpr (COUNTS) {
+        par_node->counts_.erase(par_node->counts_.begin() + child_pos);
+    }
+    par_node->key_num_--;
+    free_node(node);
+    // update parent
+    if (par_node->key_num_ == 0) {
+        remove_update_parent(par_node, path);
     }
 }
-#endif  // INCLUDE_BPTREE_H_
\ No newline at end of file
+#endif  // INCLUDE_BPTREE_H_
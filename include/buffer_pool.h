@@ -0,0 +1,604 @@
+/*!
+ * @file buffer_pool.h
+ * @author Luminolt
+ * @brief bounded page cache between bptree and page_store
+ */
+
+#ifndef INCLUDE_BUFFER_POOL_H_
+#define INCLUDE_BUFFER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "page_store.h"
+#include "rw_latch.h"
+
+// how a handle holds the latch of its node
+enum LATCH_MODE : uint8_t { latch_none, latch_shared, latch_exclusive };
+
+// read_ahead() requests waiting at most, more are dropped
+constexpr std::size_t READ_AHEAD_QUEUE = 64;
+
+/*!
+ * @brief template class for buffer pool
+ * @tparam NODE node type, it should provide
+ *      - NODE(page_id_t) for an empty node
+ *      - serialize(char *) / deserialize(const char *) on a page of the store's page size
+ *      - next_page_, the next page on its chain (-1 for none), for read_ahead()
+ * @brief Buffer Pool
+ *      - caches at most capacity nodes, already deserialized
+ *      - nodes are pinned by handles, a pinned node is never evicted
+ *      - CLOCK eviction, dirty nodes are written back on eviction or flush
+ *      - a node is dirty only if someone called mark_dirty() on its handle
+ *      - in no-steal mode dirty nodes are never evicted, only flush() writes
+ *        them, and the pool grows past capacity if every frame is dirty
+ *      - thread safe: the page table is under a reader/writer lock (hits only
+ *        read it), and each node has a latch its handle can hold. Changing a
+ *        node or its dirty bit takes the exclusive latch.
+ *      - a miss reads the page outside the lock, holding the new frame's latch,
+ *        so other pages are served meanwhile and a fetch of the same page waits
+ *        for that read. A dirty victim is written back outside the lock too.
+ */
+template <class NODE>
+class buffer_pool {
+protected:
+    struct frame {
+        NODE node;
+        page_id_t page_id;
+        std::atomic<int> pin_count;
+        std::atomic<bool> referenced;  // CLOCK bit
+        std::atomic<bool> discarded;   // dropped while pinned, the last unpin frees it
+        std::atomic<bool> loading;     // being read, the reader holds the latch
+        bool dirty;                    // modified since read
+        rw_latch latch;
+
+        explicit frame(page_id_t page_id)
+            : node(page_id), page_id(page_id), pin_count(0), referenced(false), discarded(false),
+              loading(false), dirty(false) {}
+    };
+
+public:
+    /*!
+     * @brief handle class
+     * @brief a pinned node, unlatched and unpinned when the handle dies
+     */
+    class handle {
+    public:
+        handle() : pool_(nullptr), frame_(nullptr), mode_(latch_none) {}
+        handle(buffer_pool *pool, frame *f) : pool_(pool), frame_(f), mode_(latch_none) {}
+
+        // move only
+        handle(const handle &) = delete;
+        handle &operator=(const handle &) = delete;
+        handle(handle &&other) noexcept
+            : pool_(other.pool_), frame_(other.frame_), mode_(other.mode_) {
+            other.frame_ = nullptr;
+            other.mode_ = latch_none;
+        }
+        handle &operator=(handle &&other) noexcept {
+            if (this != &other) {
+                release();
+                pool_ = other.pool_;
+                frame_ = other.frame_;
+                mode_ = other.mode_;
+                other.frame_ = nullptr;
+                other.mode_ = latch_none;
+            }
+            return *this;
+        }
+
+        ~handle() { release(); }
+
+        NODE *operator->() const { return &frame_->node; }
+        NODE &operator*() const { return frame_->node; }
+        explicit operator bool() const { return frame_ != nullptr; }
+
+        page_id_t page_id() const { return frame_->page_id; }
+
+        // call it before (or right after) changing the node
+        void mark_dirty() const {
+            if (!frame_->dirty) {
+                frame_->dirty = true;
+                pool_->dirty_count_++;
+            }
+        }
+        bool is_dirty() const { return frame_->dirty; }
+
+        // take the node latch, the handle drops it when released
+        void latch(LATCH_MODE mode) {
+            if (mode == latch_shared) {
+                frame_->latch.lock_shared();
+            } else if (mode == latch_exclusive) {
+                frame_->latch.lock();
+            }
+            mode_ = mode;
+        }
+        void unlatch() {
+            if (mode_ == latch_shared) {
+                frame_->latch.unlock_shared();
+            } else if (mode_ == latch_exclusive) {
+                frame_->latch.unlock();
+            }
+            mode_ = latch_none;
+        }
+
+        // version of the node latch, see rw_latch
+        uint32_t version() const { return frame_->latch.version(); }
+
+        // optimistic reads of an unlatched node, see rw_latch
+        bool read_begin(uint32_t &version) const { return frame_->latch.read_begin(version); }
+        bool read_validate(uint32_t version) const {
+            return frame_->latch.read_validate(version) && !frame_->discarded;
+        }
+        bool try_upgrade(uint32_t version) {
+            if (!frame_->latch.try_upgrade(version)) {
+                return false;
+            }
+            mode_ = latch_exclusive;
+            return true;
+        }
+
+        // the page was discarded while we held it, the node is a stale copy
+        bool discarded() const { return frame_->discarded; }
+
+        // another handle on the same node, pinned again and not latched
+        handle pin() const {
+            frame_->pin_count++;  // pinned already, it can't go away meanwhile
+            return handle(pool_, frame_);
+        }
+
+        // unlatch and unpin before the handle dies
+        void release() {
+            if (frame_ != nullptr) {
+                unlatch();
+                pool_->unpin(frame_);
+                frame_ = nullptr;
+            }
+        }
+
+    private:
+        buffer_pool *pool_;
+        frame *frame_;
+        LATCH_MODE mode_;
+    };
+
+    // constructor
+    buffer_pool(page_store *store, std::size_t capacity);
+
+    // destructor, write everything back (in no-steal mode the owner flushes)
+    ~buffer_pool() {
+        {
+            std::lock_guard<std::mutex> lock(ahead_mutex_);
+            stopping_ = true;
+        }
+        ahead_wake_.notify_one();
+        if (reader_.joinable()) {
+            reader_.join();
+        }
+        if (!no_steal_) {
+            flush();
+        }
+    }
+
+    // get a node, read from disk on miss, and latch it
+    handle fetch(page_id_t page_id, LATCH_MODE mode = latch_none);
+
+    // get an empty node for a new page, nothing is read (and it is dirty),
+    // it comes latched exclusively. A page id may be reused, a cached copy of
+    // the old page is dropped as discard() does.
+    handle create(page_id_t page_id);
+
+    // drop a page without writing it back, those who still pin it
+    // keep a stale copy until they let it go. Returns once no copy of it
+    // is being written, so the page may be written anew.
+    void discard(page_id_t page_id);
+
+    // Read page_id and the count - 1 pages after it on the node chain into the
+    // pool on a helper thread, without waiting. A hint, errors are ignored.
+    void read_ahead(page_id_t page_id, int count);
+
+    // write all dirty nodes back
+    void flush();
+
+    // call func(page_id, node) on each dirty node, nobody may be changing nodes
+    template <class FUNC>
+    void for_each_dirty(FUNC &&func) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        for (auto &item : page_table_) {
+            if (item.second->dirty) {
+                func(item.first, item.second->node);
+            }
+        }
+    }
+
+    // keep dirty nodes in memory until flush()
+    void set_no_steal(bool no_steal) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        no_steal_ = no_steal;
+    }
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return page_table_.size();
+    }
+    std::size_t dirty_count() const { return dirty_count_; }
+
+protected:
+    page_store *store_;
+    std::size_t capacity_;
+    mutable std::shared_mutex mutex_;  // guards the members below and frame placement
+    std::vector<std::unique_ptr<frame>> frames_;
+    std::vector<frame *> free_frames_;
+    std::unordered_map<page_id_t, frame *> page_table_;
+    std::size_t clock_hand_;
+    std::atomic<std::size_t> dirty_count_;
+    bool no_steal_;
+    std::unordered_set<page_id_t> writing_;  // victims written back with the mutex let go
+    std::condition_variable_any written_;     // one of them is on disk
+
+    // read_ahead() requests, for reader_ (started on the first one)
+    std::mutex ahead_mutex_;  // guards ahead_, stopping_ and starting reader_
+    std::condition_variable ahead_wake_;
+    std::deque<std::pair<page_id_t, int>> ahead_;
+    bool stopping_;
+    std::thread reader_;
+
+    // the helper thread of read_ahead()
+    void reader_loop();
+
+    // get an unused frame for page_id and put it in the table, evict one if the
+    // pool is full. Writing a dirty victim back, or waiting for a dropped copy
+    // of page_id to be written, lets go of the mutex held by lock, null if
+    // page_id got in the table meanwhile.
+    frame *get_frame(page_id_t page_id, std::unique_lock<std::shared_mutex> &lock);
+
+    // write a dirty victim back with the mutex held by lock let go, its shared
+    // latch keeps writers out meanwhile. True if it is out of the table and
+    // can be used, false if someone wanted it again.
+    bool evict_dirty(frame *f, std::unique_lock<std::shared_mutex> &lock);
+
+    // write a frame back to its page if it is dirty
+    void write_back(frame *f);
+
+    // a handle let go of a frame
+    void unpin(frame *f);
+
+    // take a page out of the table, the mutex is held
+    void drop(typename std::unordered_map<page_id_t, frame *>::iterator it);
+
+    // read the page of a frame just placed and pinned, with the mutex held by
+    // lock, which is let go during the read. Throws with the frame dropped.
+    void load(frame *f, std::unique_lock<std::shared_mutex> &lock);
+};
+
+template <class NODE>
+buffer_pool<NODE>::buffer_pool(page_store *store, std::size_t capacity) {
+    if (capacity == 0) {
+        throw std::invalid_argument("buffer_pool: capacity must be positive");
+    }
+    store_ = store;
+    capacity_ = capacity;
+    clock_hand_ = 0;
+    dirty_count_ = 0;
+    no_steal_ = false;
+    stopping_ = false;
+}
+
+template <class NODE>
+typename buffer_pool<NODE>::handle buffer_pool<NODE>::fetch(page_id_t page_id, LATCH_MODE mode) {
+    while (true) {
+        frame *f = nullptr;
+        {
+            // hit, the common case
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = page_table_.find(page_id);
+            if (it != page_table_.end()) {
+                f = it->second;
+                f->pin_count++;
+                f->referenced.store(true, std::memory_order_relaxed);
+            }
+        }
+        if (f == nullptr) {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            auto it = page_table_.find(page_id);
+            if (it != page_table_.end()) {
+                f = it->second;  // read by someone else meanwhile
+                f->pin_count++;
+                f->referenced.store(true, std::memory_order_relaxed);
+            } else {
+                f = get_frame(page_id, lock);
+                if (f == nullptr) {
+                    continue;  // read by someone else while a victim was written
+                }
+                f->pin_count++;
+                f->referenced.store(true, std::memory_order_relaxed);
+                load(f, lock);
+            }
+        }
+        if (f->loading.load(std::memory_order_acquire)) {
+            // wait for whoever reads it, then make sure the read went well
+            f->latch.lock_shared();
+            f->latch.unlock_shared();
+            if (f->discarded) {
+                unpin(f);
+                continue;
+            }
+        }
+        // latch outside the lock, it may wait for other threads
+        handle h(this, f);
+        h.latch(mode);
+        return h;
+    }
+}
+
+template <class NODE>
+void buffer_pool<NODE>::load(frame *f, std::unique_lock<std::shared_mutex> &lock) {
+    // nobody else holds the latch of a frame just placed
+    f->latch.lock();
+    f->loading.store(true, std::memory_order_relaxed);
+    lock.unlock();
+    std::vector<char> buf(store_->page_size());
+    try {
+        store_->read_page(f->page_id, buf.data());
+        f->node.deserialize(buf.data());
+    } catch (...) {
+        // drop it, those waiting see it discarded and read it again themselves
+        lock.lock();
+        auto it = page_table_.find(f->page_id);
+        if (it != page_table_.end() && it->second == f) {
+            drop(it);
+        }
+        f->loading.store(false, std::memory_order_release);
+        f->latch.unlock();
+        lock.unlock();
+        unpin(f);
+        throw;
+    }
+    f->loading.store(false, std::memory_order_release);
+    f->latch.unlock();
+}
+
+template <class NODE>
+typename buffer_pool<NODE>::handle buffer_pool<NODE>::create(page_id_t page_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = page_table_.find(page_id);
+    if (it != page_table_.end()) {
+        drop(it);  // a stale copy, someone read the page after it was freed
+    }
+    frame *f;
+    while ((f = get_frame(page_id, lock)) == nullptr) {
+        drop(page_table_.find(page_id));
+    }
+    f->pin_count++;
+    f->referenced = true;
+    f->dirty = true;
+    dirty_count_++;
+    handle h(this, f);
+    h.latch(latch_exclusive);  // nobody else can see it yet
+    return h;
+}
+
+template <class NODE>
+void buffer_pool<NODE>::read_ahead(page_id_t page_id, int count) {
+    if (page_id == -1 || count <= 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ahead_mutex_);
+        if (ahead_.size() >= READ_AHEAD_QUEUE) {
+            return;  // far behind already
+        }
+        ahead_.emplace_back(page_id, count);
+        if (!reader_.joinable()) {
+            reader_ = std::thread(&buffer_pool::reader_loop, this);
+        }
+    }
+    ahead_wake_.notify_one();
+}
+
+template <class NODE>
+void buffer_pool<NODE>::reader_loop() {
+    std::unique_lock<std::mutex> lock(ahead_mutex_);
+    while (true) {
+        ahead_wake_.wait(lock, [this] { return stopping_ || !ahead_.empty(); });
+        if (stopping_) {
+            return;
+        }
+        auto [page_id, count] = ahead_.front();
+        ahead_.pop_front();
+        lock.unlock();
+        try {
+            // cached pages are just passed, the chain may change under us but
+            // a wrong page only costs a read
+            for (int i = 0; i < count && page_id != -1; ++i) {
+                page_id = fetch(page_id, latch_shared)->next_page_;
+            }
+        } catch (...) {
+            // the scan reads it itself if it gets there
+        }
+        lock.lock();
+    }
+}
+
+template <class NODE>
+void buffer_pool<NODE>::discard(page_id_t page_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = page_table_.find(page_id);
+    if (it != page_table_.end()) {
+        drop(it);
+    }
+    written_.wait(lock, [&] { return writing_.count(page_id) == 0; });
+}
+
+template <class NODE>
+void buffer_pool<NODE>::drop(typename std::unordered_map<page_id_t, frame *>::iterator it) {
+    frame *f = it->second;
+    page_table_.erase(it);
+    if (f->dirty) {
+        f->dirty = false;
+        dirty_count_--;
+    }
+    // whoever sees the frame unpinned and still discarded frees it, both under
+    // the mutex: until then CLOCK must not take it, it is in no table entry
+    f->discarded = true;
+    if (f->pin_count == 0) {
+        f->discarded = false;
+        free_frames_.push_back(f);
+    }
+}
+
+template <class NODE>
+void buffer_pool<NODE>::unpin(frame *f) {
+    if (f->pin_count.fetch_sub(1) == 1 && f->discarded) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (f->pin_count == 0 && f->discarded) {
+            f->discarded = false;
+            free_frames_.push_back(f);
+        }
+    }
+}
+
+template <class NODE>
+void buffer_pool<NODE>::flush() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto &item : page_table_) {
+        write_back(item.second);
+    }
+    store_->flush();
+}
+
+template <class NODE>
+typename buffer_pool<NODE>::frame *buffer_pool<NODE>::get_frame(
+    page_id_t page_id, std::unique_lock<std::shared_mutex> &lock) {
+    frame *f = nullptr;
+    bool unlocked = false;
+    if (writing_.count(page_id) != 0) {
+        // a dropped copy is on its way to disk, ours must not land before it
+        written_.wait(lock, [&] { return writing_.count(page_id) == 0; });
+        if (page_table_.count(page_id) != 0) {
+            return nullptr;
+        }
+    }
+    while (f == nullptr) {
+        if (!free_frames_.empty()) {
+            f = free_frames_.back();
+            free_frames_.pop_back();
+            break;
+        }
+        if (frames_.size() < capacity_) {
+            frames_.emplace_back(std::make_unique<frame>(page_id));
+            f = frames_.back().get();
+            break;
+        }
+        // CLOCK: give referenced frames a second chance
+        frame *victim = nullptr;
+        for (std::size_t i = 0; i < 2 * frames_.size(); ++i) {
+            frame *cur = frames_[clock_hand_].get();
+            clock_hand_ = (clock_hand_ + 1) % frames_.size();
+            if (cur->pin_count > 0 || cur->discarded || (no_steal_ && cur->dirty)) {
+                continue;
+            }
+            if (cur->referenced) {
+                cur->referenced = false;
+                continue;
+            }
+            victim = cur;
+            break;
+        }
+        if (victim == nullptr) {
+            if (!no_steal_) {
+                throw std::runtime_error("buffer_pool: all pages are pinned");
+            }
+            // everything left is dirty, hold it until the next flush
+            frames_.emplace_back(std::make_unique<frame>(page_id));
+            f = frames_.back().get();
+        } else if (!victim->dirty) {
+            page_table_.erase(victim->page_id);
+            f = victim;
+        } else {
+            unlocked = true;
+            if (evict_dirty(victim, lock)) {
+                f = victim;
+            }
+        }
+    }
+    if (unlocked && page_table_.count(page_id) != 0) {
+        free_frames_.push_back(f);
+        return nullptr;
+    }
+    f->node = NODE(page_id);
+    f->page_id = page_id;
+    f->pin_count = 0;
+    f->referenced = false;
+    f->discarded = false;
+    f->loading = false;
+    f->dirty = false;
+    page_table_[page_id] = f;
+    return f;
+}
+
+template <class NODE>
+bool buffer_pool<NODE>::evict_dirty(frame *f, std::unique_lock<std::shared_mutex> &lock) {
+    f->pin_count++;  // CLOCK passes it by meanwhile
+    page_id_t page_id = f->page_id;
+    writing_.insert(page_id);
+    lock.unlock();
+    std::vector<char> buf(store_->page_size());
+    f->latch.lock_shared();  // unpinned till now, nobody held it
+    try {
+        f->node.serialize(buf.data());
+        store_->write_page(f->page_id, buf.data());
+    } catch (...) {
+        f->latch.unlock_shared();
+        lock.lock();
+        writing_.erase(page_id);
+        written_.notify_all();
+        if (--f->pin_count == 0 && f->discarded) {
+            f->discarded = false;
+            free_frames_.push_back(f);
+        }
+        throw;
+    }
+    lock.lock();
+    writing_.erase(page_id);
+    written_.notify_all();
+    if (f->dirty) {  // still latched, nobody changed it since it was written
+        f->dirty = false;
+        dirty_count_--;
+    }
+    f->latch.unlock_shared();
+    if (--f->pin_count == 0 && f->discarded) {
+        f->discarded = false;  // dropped meanwhile, it is ours
+        return true;
+    }
+    if (f->pin_count > 0 || f->discarded || f->referenced) {
+        return false;  // fetched again meanwhile, clean now for the next sweep
+    }
+    page_table_.erase(f->page_id);
+    return true;
+}
+
+template <class NODE>
+void buffer_pool<NODE>::write_back(frame *f) {
+    if (!f->dirty) {
+        return;
+    }
+    std::vector<char> buf(store_->page_size());
+    f->node.serialize(buf.data());
+    store_->write_page(f->page_id, buf.data());
+    f->dirty = false;
+    dirty_count_--;
+}
+
+#endif  // INCLUDE_BUFFER_POOL_H_
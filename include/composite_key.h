@@ -0,0 +1,153 @@
+/*!
+ * @file composite_key.h
+ * @author Luminolt
+ * @brief composite_key, a few ids packed into one 64-bit key
+ */
+
+#ifndef INCLUDE_COMPOSITE_KEY_H_
+#define INCLUDE_COMPOSITE_KEY_H_
+
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "id_t.h"
+
+// bits needed for every number up to max
+constexpr int bits_for(uint64_t max) { return max == 0 ? 0 : 1 + bits_for(max >> 1); }
+
+// How a field of a composite_key is packed: its width in bits, and to / from
+// the number in them. Ids, unsigned integers and enums are known.
+template <class T, class = void>
+struct key_field;
+
+template <int LENGTH>
+struct key_field<id_t<LENGTH>> {
+    static constexpr int BITS = bits_for(id_t<LENGTH>::LIMIT - 1);
+    static constexpr uint64_t pack(const id_t<LENGTH> &id) { return uint64_t(int(id)); }
+    static constexpr id_t<LENGTH> unpack(uint64_t raw) { return id_t<LENGTH>(int(raw)); }
+};
+
+template <class T>
+struct key_field<T, std::enable_if_t<std::is_unsigned<T>::value>> {
+    static constexpr int BITS = 8 * sizeof(T);
+    static constexpr uint64_t pack(T num) { return num; }
+    static constexpr T unpack(uint64_t raw) { return T(raw); }
+};
+
+// enums by their underlying number, which must not be negative
+template <class T>
+struct key_field<T, std::enable_if_t<std::is_enum<T>::value>> {
+    typedef std::make_unsigned_t<std::underlying_type_t<T>> number_t;
+    static constexpr int BITS = 8 * sizeof(number_t);
+    static constexpr uint64_t pack(T val) { return number_t(val); }
+    static constexpr T unpack(uint64_t raw) { return T(number_t(raw)); }
+};
+
+/*!
+ * @brief composite_key class
+ * @tparam FIELDS the fields, most significant first
+ * @brief for keys made of a few ids, e.g. a tube, its queue and a place in it
+ *      - packed into one uint64_t with the first field in the highest bits, so
+ *        keys compare field by field as plain integers
+ *      - trivially copyable, a bptree stores its 8 bytes as they are
+ *      - min_with / max_with bound the keys starting with some fields
+ */
+template <class... FIELDS>
+class composite_key {
+    template <std::size_t I>
+    using field_t = std::tuple_element_t<I, std::tuple<FIELDS...>>;
+
+    static constexpr int WIDTHS[] = {key_field<FIELDS>::BITS...};
+
+public:
+    static constexpr int BITS = (key_field<FIELDS>::BITS + ...);
+    static_assert(BITS <= 64, "composite_key: the fields do not fit in 64 bits");
+
+    // default constructor
+    composite_key() = default;
+
+    // argument constructor
+    constexpr composite_key(const FIELDS &...fields) : raw_(pack_head(fields...)) {}
+
+    // the I-th field
+    template <std::size_t I>
+    constexpr field_t<I> get() const {
+        int low = BITS - head_bits(I + 1);
+        return key_field<field_t<I>>::unpack((raw_ >> low) & low_mask(WIDTHS[I]));
+    }
+
+    // The smallest / largest key whose first fields are head, for range searches
+    template <class... HEAD>
+    static constexpr composite_key min_with(const HEAD &...head) {
+        return from_raw(shift_in(pack_head(head...), BITS - head_bits(sizeof...(HEAD)), 0));
+    }
+    template <class... HEAD>
+    static constexpr composite_key max_with(const HEAD &...head) {
+        int rest = BITS - head_bits(sizeof...(HEAD));
+        return from_raw(shift_in(pack_head(head...), rest, low_mask(rest)));
+    }
+
+    // the packed number, and back
+    constexpr uint64_t raw() const { return raw_; }
+    static constexpr composite_key from_raw(uint64_t raw) { return composite_key(raw_tag(), raw); }
+
+    // compare operations
+    constexpr bool operator>(const composite_key &other) const { return raw_ > other.raw_; }
+    constexpr bool operator<(const composite_key &other) const { return raw_ < other.raw_; }
+    constexpr bool operator==(const composite_key &other) const { return raw_ == other.raw_; }
+    constexpr bool operator!=(const composite_key &other) const { return raw_ != other.raw_; }
+    constexpr bool operator>=(const composite_key &other) const { return raw_ >= other.raw_; }
+    constexpr bool operator<=(const composite_key &other) const { return raw_ <= other.raw_; }
+
+protected:
+    uint64_t raw_;
+
+    struct raw_tag {};
+    constexpr composite_key(raw_tag, uint64_t raw) : raw_(raw) {}
+
+    // bits of the first n fields
+    static constexpr int head_bits(std::size_t n) {
+        int bits = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            bits += WIDTHS[i];
+        }
+        return bits;
+    }
+
+    static constexpr uint64_t low_mask(int bits) {
+        return bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+    }
+
+    // raw followed by the bits low, which fit in them
+    static constexpr uint64_t shift_in(uint64_t raw, int bits, uint64_t low) {
+        return bits == 64 ? low : (raw << bits) | low;
+    }
+
+    // the first fields packed, in the low head_bits(sizeof...(HEAD)) bits
+    template <class... HEAD>
+    static constexpr uint64_t pack_head(const HEAD &...head) {
+        static_assert(sizeof...(HEAD) <= sizeof...(FIELDS), "composite_key: too many fields");
+        return pack_fields(std::index_sequence_for<HEAD...>(), head...);
+    }
+    template <std::size_t... I, class... HEAD>
+    static constexpr uint64_t pack_fields(std::index_sequence<I...>, const HEAD &...head) {
+        uint64_t raw = 0;
+        ((raw = shift_in(raw, WIDTHS[I], key_field<field_t<I>>::pack(field_t<I>(head)))), ...);
+        return raw;
+    }
+};
+
+namespace std {
+// hash of the packed number, for leaf filters
+template <class... FIELDS>
+struct hash<composite_key<FIELDS...>> {
+    size_t operator()(const composite_key<FIELDS...> &key) const {
+        return hash<uint64_t>()(key.raw());
+    }
+};
+}  // namespace std
+
+#endif  // INCLUDE_COMPOSITE_KEY_H_
@@ -8,10 +8,13 @@
 
 #include <time.h>
 
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 #include "id_t.h"
+#include "page_codec.h"
 
 enum RESULT_STATUS { nega, posi, waitfor_uploading };
 
@@ -43,8 +46,49 @@ struct examine_log {
     std::istream &input(std::istream &is);
     std::ostream &output(std::ostream &os);
 
+    // binary layout in pages and the log: the ids and order as int32, status as
+    // a byte, update_time as int64, no padding
+    static constexpr std::size_t BINARY_SIZE =
+        4 * sizeof(int32_t) + sizeof(uint8_t) + sizeof(int64_t);
+    void encode(char *buf) const;
+    void decode(const char *buf);
+
     friend std::istream &operator>>(std::istream &is, examine_log &log) { return log.input(is); }
     friend std::ostream &operator<<(std::ostream &os, examine_log &log) { return log.output(os); }
 };
 
+static_assert(sizeof(id_t<5>) == sizeof(int32_t) && sizeof(id_t<2>) == sizeof(int32_t) &&
+                  sizeof(id_t<8>) == sizeof(int32_t) && sizeof(time_t) <= sizeof(int64_t),
+              "examine_log: ids are packed as int32 and times as int64");
+static_assert(record_size<examine_log>() == 25, "examine_log: the page layout has changed");
+
+inline void examine_log::encode(char *buf) const {
+    page_writer writer(buf, BINARY_SIZE);
+    writer.put(id);
+    writer.put(queue_id);
+    writer.put(person_id);
+    writer.put(int32_t(order));
+    writer.put(uint8_t(status));
+    writer.put(int64_t(update_time));
+}
+
+inline void examine_log::decode(const char *buf) {
+    page_reader reader(buf, BINARY_SIZE);
+    int32_t raw_order;
+    uint8_t raw_status;
+    int64_t time;
+    reader.get(id);
+    reader.get(queue_id);
+    reader.get(person_id);
+    reader.get(raw_order);
+    reader.get(raw_status);
+    reader.get(time);
+    if (raw_status > waitfor_uploading) {
+        throw std::runtime_error("examine_log: broken record");
+    }
+    order = raw_order;
+    status = RESULT_STATUS(raw_status);
+    update_time = time;
+}
+
 #endif  // INCLUDE_EXAMINE_LOG_H_
\ No newline at end of file
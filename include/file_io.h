@@ -0,0 +1,75 @@
+/*!
+ * @file file_io.h
+ * @author Luminolt
+ * @brief the few file operations stdio lacks: 64-bit seek, fsync and truncate
+ */
+
+#ifndef INCLUDE_FILE_IO_H_
+#define INCLUDE_FILE_IO_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// seek to a byte offset, files can be larger than 2 GiB
+inline void seek_file(std::FILE *file, int64_t offset) {
+#ifdef _WIN32
+    int ret = _fseeki64(file, offset, SEEK_SET);
+#else
+    int ret = fseeko(file, offset, SEEK_SET);
+#endif
+    if (ret != 0) {
+        throw std::runtime_error("seek_file: seek failed");
+    }
+}
+
+// push the file down to the disk, not just to the OS
+inline void sync_file(std::FILE *file) {
+    if (std::fflush(file) != 0) {
+        throw std::runtime_error("sync_file: flush failed");
+    }
+#ifdef _WIN32
+    int ret = _commit(_fileno(file));
+#else
+    int ret = fsync(fileno(file));
+#endif
+    if (ret != 0) {
+        throw std::runtime_error("sync_file: fsync failed");
+    }
+}
+
+// cut the file down to size bytes
+inline void truncate_file(std::FILE *file, int64_t size) {
+    if (std::fflush(file) != 0) {
+        throw std::runtime_error("truncate_file: flush failed");
+    }
+#ifdef _WIN32
+    int ret = _chsize_s(_fileno(file), size);
+#else
+    int ret = ftruncate(fileno(file), off_t(size));
+#endif
+    if (ret != 0) {
+        throw std::runtime_error("truncate_file: truncate failed");
+    }
+}
+
+// open for read and write, create the file if it is not there
+inline std::FILE *open_file(const std::string &file_name) {
+    std::FILE *file = std::fopen(file_name.c_str(), "r+b");
+    if (file == nullptr) {
+        file = std::fopen(file_name.c_str(), "w+b");
+    }
+    if (file == nullptr) {
+        throw std::runtime_error("open_file: can not open " + file_name);
+    }
+    return file;
+}
+
+#endif  // INCLUDE_FILE_IO_H_
@@ -7,27 +7,49 @@
 #ifndef INCLUDE_ID_T_H_
 #define INCLUDE_ID_T_H_
 
-#include <cmath>
+#include <charconv>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
+// 10^n, for the bounds of ids
+constexpr int ten_to(int n) { return n == 0 ? 1 : 10 * ten_to(n - 1); }
 
 /*!
  * @brief id_t class
  * @tparam LENGTH the length of the id
  * @brief for annoying id compare~
+ *      - an id is LENGTH decimal digits, leading zeros kept, held as an int
+ *      - parsed with from_chars and formatted into a caller's buffer (to_chars),
+ *        a std::string only if asked for. Ids made of ids (prefix, append,
+ *        min_with / max_with) are plain arithmetic.
  */
 template <int LENGTH>
 class id_t {
+    static_assert(LENGTH > 0 && LENGTH <= 9, "id_t: the digits must fit in an int");
+
 public:
+    // an id is an int underneath, the b+tree searches id keys as ints
+    typedef int raw_type;
+
+    // ids are in [0, LIMIT)
+    static constexpr int LIMIT = ten_to(LENGTH);
+
     // default constructor
     id_t() = default;
 
     // argument constructor
-    id_t(std::string str);
-    id_t(int num);
-    id_t(const char *str);
+    id_t(std::string str) : id_t(str.data(), str.length()) {}
+    constexpr id_t(int num) : value_(num) {
+        if (num < 0 || num >= LIMIT) {
+            throw std::invalid_argument("id_t: invalid number");
+        }
+    }
+    id_t(const char *str) : id_t(str, std::strlen(str)) {}
+    id_t(const char *str, std::size_t len);
 
     // copy constructor
     id_t(const id_t &id) = default;
@@ -54,74 +76,87 @@ public:
 
     // iostream
     friend std::istream &operator>>(std::istream &is, id_t &id) { return id.input(is); }
-    friend std::ostream &operator<<(std::ostream &os, id_t &id) { return id.output(os); }
+    friend std::ostream &operator<<(std::ostream &os, const id_t &id) { return id.output(os); }
 
     // input and output
     std::istream &input(std::istream &is);
-    std::ostream &output(std::ostream &os);
+    std::ostream &output(std::ostream &os) const;
+
+    // Write the LENGTH digits to buf (no '\0'), returns the end
+    constexpr char *to_chars(char *buf) const {
+        int num = value_;
+        for (int i = LENGTH - 1; i >= 0; --i) {
+            buf[i] = char('0' + num % 10);
+            num /= 10;
+        }
+        return buf + LENGTH;
+    }
+
+    // The first N digits, e.g. the building of a person
+    template <int N>
+    constexpr id_t<N> prefix() const {
+        static_assert(N <= LENGTH, "id_t: prefix longer than the id");
+        return id_t<N>(value_ / ten_to(LENGTH - N));
+    }
+
+    // This id followed by the digits of tail
+    template <int N>
+    constexpr id_t<LENGTH + N> append(id_t<N> tail) const {
+        return id_t<LENGTH + N>(value_ * ten_to(N) + int(tail));
+    }
+
+    // The smallest / largest id starting with head, for range searches
+    template <int N>
+    static constexpr id_t min_with(id_t<N> head) {
+        static_assert(N <= LENGTH, "id_t: prefix longer than the id");
+        return id_t(int(head) * ten_to(LENGTH - N));
+    }
+    template <int N>
+    static constexpr id_t max_with(id_t<N> head) {
+        static_assert(N <= LENGTH, "id_t: prefix longer than the id");
+        return id_t(int(head) * ten_to(LENGTH - N) + ten_to(LENGTH - N) - 1);
+    }
 
     // convertor
     operator std::string() const;
-    operator int() const { return value_; }
+    constexpr operator int() const { return value_; }
 
 protected:
     int value_;
 };
 
 template <int LENGTH>
-id_t<LENGTH>::id_t(std::string str) {
-    if (str.length() != LENGTH) {
+id_t<LENGTH>::id_t(const char *str, std::size_t len) {
+    // all LENGTH characters must be digits, no sign or spaces
+    if (len != LENGTH) {
         throw std::invalid_argument("id_t: invalid string length");
     }
-    value_ = std::atoi(str.c_str());
-}
-
-template <int LENGTH>
-id_t<LENGTH>::id_t(int num) {
-    if (num < 0 || num > std::pow(10, LENGTH)) {
-        throw std::invalid_argument("id_t: invalid number");
-    }
-    value_ = num;
-}
-
-template <int LENGTH>
-id_t<LENGTH>::id_t(const char *str) {
-    if (strlen(str) != LENGTH) {
-        throw std::invalid_argument("id_t: invalid string length");
+    auto res = std::from_chars(str, str + len, value_);
+    if (str[0] == '-' || res.ptr != str + len || res.ec != std::errc()) {
+        throw std::invalid_argument("id_t: invalid string");
     }
-    value_ = std::atoi(str);
 }
 
 template <int LENGTH>
 std::istream &id_t<LENGTH>::input(std::istream &is) {
-    std::string str;
-    is >> str;
-    if (str.length() != LENGTH) {
-        throw std::invalid_argument("id_t: invalid string length");
-    }
-    value_ = std::atoi(str.c_str());
+    // one more than LENGTH, so that a longer word is caught, and nothing
+    // read is an empty word
+    char str[LENGTH + 2] = {};
+    is >> std::setw(sizeof(str)) >> str;
+    *this = id_t(str);
     return is;
 }
 
 template <int LENGTH>
-std::ostream &id_t<LENGTH>::output(std::ostream &os) {
-    std::string str = std::to_string(value_);
-    // padding
-    if (str.length() < LENGTH) {
-        str = std::string(LENGTH - str.length(), '0') + str;
-    }
-    os << str;
-    return os;
+std::ostream &id_t<LENGTH>::output(std::ostream &os) const {
+    char str[LENGTH];
+    return os << std::string_view(str, to_chars(str) - str);  // padded by setw like a string
 }
 
 template <int LENGTH>
 id_t<LENGTH>::operator std::string() const {
-    std::string str = std::to_string(value_);
-    // padding
-    if (str.length() < LENGTH) {
-        str = std::string(LENGTH - str.length(), '0') + str;
-    }
-    return str;
+    char str[LENGTH];
+    return std::string(str, to_chars(str));
 }
 
-#endif  // INCLUDE_ID_T_H_
\ No newline at end of file
+#endif  // INCLUDE_ID_T_H_
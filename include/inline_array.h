@@ -0,0 +1,123 @@
+/*!
+ * @file inline_array.h
+ * @author Luminolt
+ * @brief fixed-capacity array with a vector-like interface
+ */
+
+#ifndef INCLUDE_INLINE_ARRAY_H_
+#define INCLUDE_INLINE_ARRAY_H_
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+/*!
+ * @brief template class for inline array
+ * @tparam T element type, it should be default constructible
+ * @tparam N capacity
+ * @brief Inline Array
+ *      - elements live inside the object, no heap allocation
+ *      - elements are contiguous, data() can be memcpy-ed for trivially copyable T
+ *      - only the first size() elements are meaningful
+ */
+template <class T, std::size_t N>
+class inline_array {
+public:
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    inline_array() : size_(0) {}
+
+    // copy only what is in use
+    inline_array(const inline_array &other) : size_(other.size_) {
+        std::copy(other.begin(), other.end(), data_);
+    }
+    inline_array &operator=(const inline_array &other) {
+        if (this != &other) {
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    iterator begin() { return data_; }
+    iterator end() { return data_ + size_; }
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    static constexpr std::size_t capacity() { return N; }
+
+    T &operator[](std::size_t i) { return data_[i]; }
+    const T &operator[](std::size_t i) const { return data_[i]; }
+    T &front() { return data_[0]; }
+    const T &front() const { return data_[0]; }
+    T &back() { return data_[size_ - 1]; }
+    const T &back() const { return data_[size_ - 1]; }
+
+    void clear() { size_ = 0; }
+
+    // new elements are value-initialized
+    void resize(std::size_t n) {
+        check(n);
+        std::fill(data_ + std::min(n, size_), data_ + n, T());
+        size_ = n;
+    }
+
+    template <class IT>
+    void assign(IT first, IT last) {
+        std::size_t n = std::distance(first, last);
+        check(n);
+        std::copy(first, last, data_);
+        size_ = n;
+    }
+
+    void push_back(const T &val) { emplace_back(val); }
+
+    template <class... ARGS>
+    void emplace_back(ARGS &&...args) {
+        check(size_ + 1);
+        data_[size_++] = T(std::forward<ARGS>(args)...);
+    }
+
+    void pop_back() { size_--; }
+
+    iterator insert(const_iterator pos, const T &val) { return emplace(pos, val); }
+
+    template <class... ARGS>
+    iterator emplace(const_iterator pos, ARGS &&...args) {
+        check(size_ + 1);
+        iterator it = data_ + (pos - data_);
+        T val(std::forward<ARGS>(args)...);
+        std::move_backward(it, end(), end() + 1);
+        *it = std::move(val);
+        size_++;
+        return it;
+    }
+
+    iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        iterator it = data_ + (first - data_);
+        std::move(data_ + (last - data_), end(), it);
+        size_ -= last - first;
+        return it;
+    }
+
+protected:
+    T data_[N];
+    std::size_t size_;
+
+    void check(std::size_t n) const {
+        if (n > N) {
+            throw std::length_error("inline_array: capacity exceeded");
+        }
+    }
+};
+
+#endif  // INCLUDE_INLINE_ARRAY_H_
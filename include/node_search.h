@@ -0,0 +1,120 @@
+/*!
+ * @file node_search.h
+ * @author Luminolt
+ * @brief key search inside a node, with SIMD for int-backed keys
+ */
+
+#ifndef INCLUDE_NODE_SEARCH_H_
+#define INCLUDE_NODE_SEARCH_H_
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+// picked at compile time, build with -mavx2 (or -march=native) for the 8-wide version
+#if defined(__GNUC__) && defined(__AVX2__)
+#define NODE_SEARCH_AVX2
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+#define NODE_SEARCH_SSE2
+#endif
+
+#if defined(NODE_SEARCH_AVX2) || defined(NODE_SEARCH_SSE2)
+#include <immintrin.h>
+#endif
+
+// a key type is int-backed if it is int, or it says so with a raw_type typedef of int:
+// it must be an int underneath and compare the same as that int
+template <class T, class = void>
+struct int_key : std::is_same<T, int> {};
+
+template <class T>
+struct int_key<T, std::void_t<typename T::raw_type>>
+    : std::bool_constant<std::is_same<typename T::raw_type, int>::value &&
+                         std::is_trivially_copyable<T>::value && sizeof(T) == sizeof(int)> {};
+
+// below this many keys we stop bisecting and compare the whole block
+#if defined(NODE_SEARCH_AVX2)
+constexpr int SIMD_BLOCK = 32;
+#elif defined(NODE_SEARCH_SSE2)
+constexpr int SIMD_BLOCK = 16;
+#else
+constexpr int SIMD_BLOCK = 8;
+#endif
+
+// number of keys in [keys, keys + n) that are greater than key
+inline int count_greater(const int *keys, int n, int key) {
+    int cnt = 0;
+    int i = 0;
+#if defined(NODE_SEARCH_AVX2)
+    __m256i pivot8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(block, pivot8)));
+        cnt += __builtin_popcount(mask);
+    }
+#endif
+#if defined(NODE_SEARCH_SSE2)
+    __m128i pivot4 = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, pivot4)));
+        cnt += __builtin_popcount(mask);
+    }
+#endif
+    for (; i < n; ++i) {
+        cnt += keys[i] > key;
+    }
+    return cnt;
+}
+
+// number of keys in [keys, keys + n) that are less than key
+inline int count_less(const int *keys, int n, int key) {
+    // keys < key  <=>  !(keys > key - 1), nothing is less than INT_MIN
+    if (key == std::numeric_limits<int>::min()) {
+        return 0;
+    }
+    return n - count_greater(keys, n, key - 1);
+}
+
+// first position with keys[pos] >= key (upper: keys[pos] > key), keys are sorted
+template <bool UPPER>
+inline int int_bound(const int *keys, int n, int key) {
+    int lo = 0;
+    int hi = n;
+    while (hi - lo > SIMD_BLOCK) {
+        int mid = (lo + hi) / 2;
+        if (UPPER ? keys[mid] <= key : keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (UPPER) {
+        return hi - count_greater(keys + lo, hi - lo, key);
+    }
+    return lo + count_less(keys + lo, hi - lo, key);
+}
+
+// std::lower_bound / std::upper_bound on a node's keys, as an index
+template <class KT>
+int node_lower_bound(const KT *keys, int n, const KT &key) {
+    if constexpr (int_key<KT>::value) {
+        return int_bound<false>(reinterpret_cast<const int *>(keys), n,
+                                *reinterpret_cast<const int *>(&key));
+    } else {
+        return std::lower_bound(keys, keys + n, key) - keys;
+    }
+}
+
+template <class KT>
+int node_upper_bound(const KT *keys, int n, const KT &key) {
+    if constexpr (int_key<KT>::value) {
+        return int_bound<true>(reinterpret_cast<const int *>(keys), n,
+                               *reinterpret_cast<const int *>(&key));
+    } else {
+        return std::upper_bound(keys, keys + n, key) - keys;
+    }
+}
+
+#endif  // INCLUDE_NODE_SEARCH_H_
@@ -6,13 +6,19 @@
 #ifndef INCLUDE_NUCLEIC_ACID_SYS_H_
 
 #include <deque>
+#include <iostream>
 #include <map>
 #include <vector>
 
 #include "bptree.h"
+#include "composite_key.h"
 #include "examine_log.h"
 #include "person_log.h"
 
+// k_bbbb_cc_d: a tube, its queue and the place in the tube
+typedef composite_key<id_t<5>, id_t<2>, uint8_t> examine_key;
+// s_xxxyyyyz: a status and a person in it
+typedef composite_key<PERSON_STATUS, id_t<8>> status_key;
 
 /*!
  * @brief NucleicAcidSys class
@@ -30,6 +36,9 @@ public:
     // Add Person info, default with status not_examined
     void AddPerson(const id_t<8> &id, const std::string &name);
 
+    // Import a roster (n, then n lines of <id name>), default with status not_examined
+    void ImportRoster(std::istream &is);
+
     // person enqueue
     void EnquePerson(const id_t<8> &id, const id_t<2> &queue_id);
 
@@ -37,6 +46,9 @@ public:
     void AddExamine(const id_t<2> &queue_id);
     void AddExamine(const id_t<8> &person_id, const id_t<2> &queue_id, bool mode = 0);
 
+    // Examine the first count people of a queue, logs are inserted in one batch
+    void AddExamineBatch(const id_t<2> &queue_id, int count);
+
     // Show the Queue
     void ShowQueue();
 
@@ -46,6 +58,9 @@ public:
     // Show status of all people.
     void ShowStatus();
 
+    // Show the people of one status, only they are read
+    void ShowStatus(PERSON_STATUS status);
+
     // Get Personal Info
     void ShowPersonalInfo(id_t<8> id, time_t time);
 
@@ -55,10 +70,20 @@ public:
 protected:
     std::vector<std::pair<id_t<2>, person_log>> get_queue();
     std::map<PERSON_STATUS, std::vector<person_log>> get_status();
+    std::vector<person_log> get_status(PERSON_STATUS status);
     person_log get_person_info(id_t<8> id);
-
-    bptree<id_t<8>, person_log, 5> person;    // xxx_yyyy_z
-    bptree<id_t<8>, examine_log, 5> examine;  // k_bbbb_cc_d
+    std::pair<examine_key, examine_log> make_examine(const id_t<8> &person_id,
+                                                     const id_t<2> &queue_id, bool mode);
+    // keep by_status in step with people whose status went from the one paired
+    // with them to status
+    void move_status(const std::vector<std::pair<id_t<8>, PERSON_STATUS>> &moved,
+                     PERSON_STATUS status);
+    // make by_status match the person tree, only what differs is written
+    void sync_status_index();
+
+    bptree<id_t<8>, person_log, DEFAULT_PAGE_SIZE, true> person;  // xxx_yyyy_z
+    bptree<examine_key, examine_log> examine;                     // k_bbbb_cc_d
+    bptree<status_key, uint8_t> by_status;  // s_xxxyyyyz, the key is all, values are 0
 
     int single_serial;
     int multiple_serial;
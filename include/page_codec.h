@@ -0,0 +1,177 @@
+/*!
+ * @file page_codec.h
+ * @author Luminolt
+ * @brief helpers to put/get fields into a fixed-size page buffer
+ */
+
+#ifndef INCLUDE_PAGE_CODEC_H_
+#define INCLUDE_PAGE_CODEC_H_
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// records written as text must fit in this many bytes
+constexpr std::size_t TEXT_RECORD_SIZE = 64;
+
+// a record type has a binary layout of its own if it says so with a static
+// BINARY_SIZE: encode(char *) const writes exactly that many bytes, and
+// decode(const char *) reads them back (throwing on bytes that make no sense)
+template <class T, class = void>
+struct binary_record : std::false_type {};
+
+template <class T>
+struct binary_record<T, std::void_t<decltype(T::BINARY_SIZE)>> : std::true_type {};
+
+// the most bytes a record of type T can take in a page
+template <class T>
+constexpr std::size_t record_size() {
+    if constexpr (binary_record<T>::value) {
+        return T::BINARY_SIZE;
+    } else if constexpr (std::is_trivially_copyable<T>::value) {
+        return sizeof(T);
+    } else {
+        return sizeof(uint16_t) + TEXT_RECORD_SIZE;
+    }
+}
+
+/*!
+ * @brief page_writer class
+ * @brief append fields to a page buffer, throws when the page overflows
+ *      - types with a binary layout (see binary_record) are encoded in place
+ *      - trivially copyable types are copied as raw bytes
+ *      - other types go through their iostream operators (length-prefixed text),
+ *        at most TEXT_RECORD_SIZE bytes so that record_size() holds
+ */
+class page_writer {
+public:
+    page_writer(char *buf, std::size_t size) : buf_(buf), size_(size), pos_(0) {}
+
+    template <class T>
+    void put(const T &val) {
+        if constexpr (binary_record<T>::value) {
+            if (pos_ + T::BINARY_SIZE > size_) {
+                throw std::runtime_error("page_writer: page overflow");
+            }
+            val.encode(buf_ + pos_);
+            pos_ += T::BINARY_SIZE;
+        } else if constexpr (std::is_trivially_copyable<T>::value) {
+            put_bytes(&val, sizeof(T));
+        } else {
+            std::ostringstream os;
+            os << const_cast<T &>(val);  // the repo's output() is not const
+            std::string str = os.str();
+            if (str.length() > TEXT_RECORD_SIZE) {
+                throw std::runtime_error("page_writer: record too long");
+            }
+            uint16_t len = str.length();
+            put_bytes(&len, sizeof(len));
+            put_bytes(str.data(), len);
+        }
+    }
+
+    // n records in a row, one memcpy if they are trivially copyable
+    template <class T>
+    void put_array(const T *vals, std::size_t n) {
+        if constexpr (std::is_trivially_copyable<T>::value && !binary_record<T>::value) {
+            put_bytes(vals, n * sizeof(T));
+        } else {
+            for (std::size_t i = 0; i < n; ++i) {
+                put(vals[i]);
+            }
+        }
+    }
+
+    void put_bytes(const void *src, std::size_t len) {
+        if (pos_ + len > size_) {
+            throw std::runtime_error("page_writer: page overflow");
+        }
+        std::memcpy(buf_ + pos_, src, len);
+        pos_ += len;
+    }
+
+    std::size_t pos() const { return pos_; }
+
+private:
+    char *buf_;
+    std::size_t size_;
+    std::size_t pos_;
+};
+
+/*!
+ * @brief page_reader class
+ * @brief the reverse of page_writer
+ */
+class page_reader {
+public:
+    page_reader(const char *buf, std::size_t size) : buf_(buf), size_(size), pos_(0) {}
+
+    template <class T>
+    void get(T &val) {
+        if constexpr (binary_record<T>::value) {
+            if (pos_ + T::BINARY_SIZE > size_) {
+                throw std::runtime_error("page_reader: broken page");
+            }
+            val.decode(buf_ + pos_);
+            pos_ += T::BINARY_SIZE;
+        } else if constexpr (std::is_trivially_copyable<T>::value) {
+            get_bytes(&val, sizeof(T));
+        } else {
+            uint16_t len;
+            get_bytes(&len, sizeof(len));
+            if (pos_ + len > size_) {
+                throw std::runtime_error("page_reader: broken page");
+            }
+            std::istringstream is(std::string(buf_ + pos_, len));
+            pos_ += len;
+            is >> val;
+        }
+    }
+
+    template <class T>
+    void get_array(T *vals, std::size_t n) {
+        if constexpr (std::is_trivially_copyable<T>::value && !binary_record<T>::value) {
+            get_bytes(vals, n * sizeof(T));
+        } else {
+            for (std::size_t i = 0; i < n; ++i) {
+                get(vals[i]);
+            }
+        }
+    }
+
+    void get_bytes(void *dst, std::size_t len) {
+        if (pos_ + len > size_) {
+            throw std::runtime_error("page_reader: broken page");
+        }
+        std::memcpy(dst, buf_ + pos_, len);
+        pos_ += len;
+    }
+
+    std::size_t pos() const { return pos_; }
+
+private:
+    const char *buf_;
+    std::size_t size_;
+    std::size_t pos_;
+};
+
+// bytes of a record as they go to a page, used to tell if a record has changed
+template <class T>
+std::string record_bytes(const T &val) {
+    if constexpr (binary_record<T>::value) {
+        std::string bytes(T::BINARY_SIZE, '\0');
+        val.encode(&bytes[0]);
+        return bytes;
+    } else if constexpr (std::is_trivially_copyable<T>::value) {
+        return std::string(reinterpret_cast<const char *>(&val), sizeof(T));
+    } else {
+        std::ostringstream os;
+        os << const_cast<T &>(val);
+        return os.str();
+    }
+}
+
+#endif  // INCLUDE_PAGE_CODEC_H_
@@ -0,0 +1,184 @@
+/*!
+ * @file page_store.h
+ * @author Luminolt
+ * @brief single-file page store for the on-file b+tree
+ */
+
+#ifndef INCLUDE_PAGE_STORE_H_
+#define INCLUDE_PAGE_STORE_H_
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "file_io.h"
+
+// we use page_id to identify a node, rather than a pointer
+typedef int page_id_t;
+
+// size of a page on disk, unless the tree asks for another one
+constexpr std::size_t DEFAULT_PAGE_SIZE = 4096;
+
+// the file grows this many pages at a time
+constexpr std::size_t PAGE_EXTENT = 64;
+
+/*!
+ * @brief page_store class
+ * @brief the whole tree lives in one file of fixed-size pages
+ *      - page i is stored at offset i * page_size
+ *      - page 0 is reserved for the tree's meta data
+ *      - the file is preallocated PAGE_EXTENT pages at a time
+ *      - safe to share between threads, each call holds the file alone
+ */
+class page_store {
+public:
+    // open (or create) the data file
+    explicit page_store(std::string file_name, std::size_t page_size = DEFAULT_PAGE_SIZE);
+
+    // destructor
+    ~page_store();
+
+    // no copy, the store owns the file
+    page_store(const page_store &) = delete;
+    page_store &operator=(const page_store &) = delete;
+
+    // read a page, pages never written are all zero
+    void read_page(page_id_t page_id, char *buf);
+
+    // write a page
+    void write_page(page_id_t page_id, const char *buf);
+
+    // mark a page as unused
+    void free_page(page_id_t page_id);
+
+    // drop the pages from page_count on, the file is cut to whole extents
+    void truncate(std::size_t page_count);
+
+    // flush the file buffer
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::fflush(file_);
+    }
+
+    // flush and fsync, the pages written so far survive a crash
+    void sync() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sync_file(file_);
+    }
+
+    // number of pages in the file
+    std::size_t page_count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return page_count_;
+    }
+
+    std::size_t page_size() const { return page_size_; }
+
+    const std::string &file_name() const { return file_name_; }
+
+protected:
+    std::string file_name_;
+    std::FILE *file_;
+    std::size_t page_size_;
+    std::size_t page_count_;  // preallocated pages in file
+    mutable std::mutex mutex_;  // one seek + read/write at a time
+
+    // write a page, the caller holds mutex_
+    void put_page(page_id_t page_id, const char *buf);
+
+    // grow the file to hold at least n pages
+    void extend(std::size_t n);
+};
+
+inline page_store::page_store(std::string file_name, std::size_t page_size) {
+    if (page_size == 0) {
+        throw std::invalid_argument("page_store: page size must be positive");
+    }
+    file_name_ = file_name;
+    page_size_ = page_size;
+    struct stat buf;
+    if (stat(file_name_.c_str(), &buf) != 0) {
+        page_count_ = 0;
+    } else {
+        page_count_ = buf.st_size / page_size_;
+    }
+    file_ = open_file(file_name_);
+}
+
+inline page_store::~page_store() {
+    std::fclose(file_);
+}
+
+inline void page_store::read_page(page_id_t page_id, char *buf) {
+    if (page_id < 0) {
+        throw std::invalid_argument("page_store: invalid page id");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::size_t(page_id) >= page_count_) {
+        std::memset(buf, 0, page_size_);
+        return;
+    }
+    seek_file(file_, int64_t(page_id) * page_size_);
+    if (std::fread(buf, 1, page_size_, file_) != page_size_) {
+        std::clearerr(file_);
+        throw std::runtime_error("page_store: read failed");
+    }
+}
+
+inline void page_store::write_page(page_id_t page_id, const char *buf) {
+    if (page_id < 0) {
+        throw std::invalid_argument("page_store: invalid page id");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    put_page(page_id, buf);
+}
+
+inline void page_store::free_page(page_id_t page_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::size_t(page_id) >= page_count_) {
+        return;  // never written
+    }
+    std::vector<char> zero(page_size_, 0);
+    put_page(page_id, zero.data());
+}
+
+inline void page_store::truncate(std::size_t page_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t new_count = (page_count + PAGE_EXTENT - 1) / PAGE_EXTENT * PAGE_EXTENT;
+    if (new_count >= page_count_) {
+        return;
+    }
+    std::fflush(file_);  // nothing buffered may land past the end later
+    truncate_file(file_, int64_t(new_count) * page_size_);
+    page_count_ = new_count;
+}
+
+inline void page_store::put_page(page_id_t page_id, const char *buf) {
+    if (std::size_t(page_id) >= page_count_) {
+        extend(page_id + 1);
+    }
+    seek_file(file_, int64_t(page_id) * page_size_);
+    if (std::fwrite(buf, 1, page_size_, file_) != page_size_) {
+        std::clearerr(file_);
+        throw std::runtime_error("page_store: write failed");
+    }
+}
+
+inline void page_store::extend(std::size_t n) {
+    // round up to the next extent
+    std::size_t new_count = (n + PAGE_EXTENT - 1) / PAGE_EXTENT * PAGE_EXTENT;
+    std::vector<char> zero((new_count - page_count_) * page_size_, 0);
+    seek_file(file_, int64_t(page_count_) * page_size_);
+    if (std::fwrite(zero.data(), 1, zero.size(), file_) != zero.size()) {
+        std::clearerr(file_);
+        throw std::runtime_error("page_store: extend failed");
+    }
+    page_count_ = new_count;
+}
+
+#endif  // INCLUDE_PAGE_STORE_H_
@@ -9,10 +9,14 @@
 
 #include <time.h>
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 #include "id_t.h"
+#include "page_codec.h"
 
 enum PERSON_STATUS {
     negative,
@@ -47,8 +51,52 @@ struct person_log {
     std::istream &input(std::istream &is);
     std::ostream &output(std::ostream &os);
 
+    // binary layout in pages and the log: id as int32, status as a byte, the
+    // name's length as a byte and the name padded to NAME_SIZE, update_time as int64
+    static constexpr std::size_t NAME_SIZE = 32;
+    static constexpr std::size_t BINARY_SIZE =
+        sizeof(int32_t) + 2 * sizeof(uint8_t) + NAME_SIZE + sizeof(int64_t);
+    void encode(char *buf) const;
+    void decode(const char *buf);
+
     friend std::istream &operator>>(std::istream &is, person_log &log) { return log.input(is); }
     friend std::ostream &operator<<(std::ostream &os, person_log &log) { return log.output(os); }
 };
 
+static_assert(sizeof(id_t<8>) == sizeof(int32_t) && sizeof(time_t) <= sizeof(int64_t),
+              "person_log: ids are packed as int32 and times as int64");
+static_assert(record_size<person_log>() == 46, "person_log: the page layout has changed");
+
+inline void person_log::encode(char *buf) const {
+    if (name.length() > NAME_SIZE) {
+        throw std::runtime_error("person_log: name too long");
+    }
+    char padded[NAME_SIZE] = {};
+    std::memcpy(padded, name.data(), name.length());
+    page_writer writer(buf, BINARY_SIZE);
+    writer.put(id);
+    writer.put(uint8_t(status));
+    writer.put(uint8_t(name.length()));
+    writer.put_bytes(padded, NAME_SIZE);
+    writer.put(int64_t(update_time));
+}
+
+inline void person_log::decode(const char *buf) {
+    page_reader reader(buf, BINARY_SIZE);
+    uint8_t raw_status, name_length;
+    int64_t time;
+    reader.get(id);
+    reader.get(raw_status);
+    reader.get(name_length);
+    if (raw_status > not_examined || name_length > NAME_SIZE) {
+        throw std::runtime_error("person_log: broken record");
+    }
+    char padded[NAME_SIZE];
+    reader.get_bytes(padded, NAME_SIZE);
+    reader.get(time);
+    name.assign(padded, name_length);
+    status = PERSON_STATUS(raw_status);
+    update_time = time;
+}
+
 #endif  // INCLUDE_PERSON_LOG_H_
\ No newline at end of file
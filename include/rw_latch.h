@@ -0,0 +1,104 @@
+/*!
+ * @file rw_latch.h
+ * @author Luminolt
+ * @brief small reader/writer latch for b+tree nodes
+ */
+
+#ifndef INCLUDE_RW_LATCH_H_
+#define INCLUDE_RW_LATCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/*!
+ * @brief rw_latch class
+ * @brief reader/writer spin latch
+ *      - one word, held for a node visit, never across I/O of other threads
+ *      - readers go first: a thread may take the shared latch again while
+ *        holding it (nested reads, copied cursors), at the price of writers
+ *        waiting for a gap between readers
+ *      - not recursive for writers
+ *      - the version goes up with each exclusive unlock, so whoever saw a version
+ *        can tell later whether a writer was there in between. That is enough
+ *        for optimistic reads: read_begin(), read the node without the latch,
+ *        then read_validate() (or try_upgrade() to write it)
+ */
+class rw_latch {
+public:
+    rw_latch() : state_(0), version_(0) {}
+
+    rw_latch(const rw_latch &) = delete;
+    rw_latch &operator=(const rw_latch &) = delete;
+
+    bool try_lock_shared() {
+        int cur = state_.load(std::memory_order_relaxed);
+        return cur >= 0 &&
+               state_.compare_exchange_weak(cur, cur + 1, std::memory_order_acquire);
+    }
+    bool try_lock() {
+        int cur = 0;
+        return state_.compare_exchange_strong(cur, WRITER, std::memory_order_acquire);
+    }
+
+    void lock_shared() {
+        for (int spin = 0; !try_lock_shared(); ++spin) {
+            backoff(spin);
+        }
+    }
+    void lock() {
+        for (int spin = 0; !try_lock(); ++spin) {
+            backoff(spin);
+        }
+    }
+
+    void unlock_shared() { state_.fetch_sub(1, std::memory_order_release); }
+    void unlock() {
+        version_.fetch_add(1, std::memory_order_release);
+        state_.store(0, std::memory_order_release);
+    }
+
+    // exclusive unlocks so far, read it under the latch
+    uint32_t version() const { return version_.load(std::memory_order_relaxed); }
+
+    // Start an optimistic read, false while a writer holds the latch
+    bool read_begin(uint32_t &version) const {
+        version = version_.load(std::memory_order_acquire);
+        return state_.load(std::memory_order_acquire) != WRITER;
+    }
+
+    // Whether nobody wrote since read_begin() gave version
+    bool read_validate(uint32_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return state_.load(std::memory_order_relaxed) != WRITER &&
+               version_.load(std::memory_order_relaxed) == version;
+    }
+
+    // Go from an optimistic read to the exclusive latch without waiting,
+    // false if someone holds it or wrote since
+    bool try_upgrade(uint32_t version) {
+        if (!try_lock()) {
+            return false;
+        }
+        if (version_.load(std::memory_order_relaxed) != version) {
+            state_.store(0, std::memory_order_release);  // nothing written, same version
+            return false;
+        }
+        return true;
+    }
+
+    // spin a little, then give the core away
+    static void backoff(int spin) {
+        if (spin >= 32) {
+            std::this_thread::yield();
+        }
+    }
+
+protected:
+    static constexpr int WRITER = -1;
+
+    std::atomic<int> state_;         // number of readers, or WRITER
+    std::atomic<uint32_t> version_;  // exclusive unlocks so far
+};
+
+#endif  // INCLUDE_RW_LATCH_H_
@@ -0,0 +1,280 @@
+/*!
+ * @file wal.h
+ * @author Luminolt
+ * @brief write-ahead log with group commit for the on-file b+tree
+ */
+
+#ifndef INCLUDE_WAL_H_
+#define INCLUDE_WAL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_io.h"
+
+// kind of a log record, the first byte of each record
+enum WAL_KIND : uint8_t { wal_insert = 1, wal_remove, wal_update, wal_page, wal_checkpoint };
+
+// how a tree uses its log
+struct wal_options {
+    bool enabled = true;
+    // commits in one window share one fsync
+    std::chrono::microseconds commit_window = std::chrono::milliseconds(2);
+    // each mutation waits for its fsync, otherwise it is durable within one window
+    bool sync_commit = false;
+    // checkpoint once this many pages are dirty, 0 for half the buffer pool
+    std::size_t checkpoint_pages = 0;
+};
+
+/*!
+ * @brief wal class
+ * @brief append-only log file of checksummed records
+ *      - a record is <length, checksum, payload>, a torn tail is ignored on read
+ *      - append() only buffers, a syncer thread writes and fsyncs the buffer
+ *        once per commit window, so concurrent commits share one fsync
+ *      - lsn is the sequence number of a record, commit(lsn, true) waits until
+ *        it is on disk
+ */
+class wal {
+public:
+    // open (or create) the log file, nothing is read yet
+    wal(std::string file_name, std::chrono::microseconds commit_window);
+
+    // destructor, everything appended is synced
+    ~wal();
+
+    // no copy, the log owns the file and the syncer
+    wal(const wal &) = delete;
+    wal &operator=(const wal &) = delete;
+
+    // buffer a record, returns its lsn
+    uint64_t append(const char *data, std::size_t len);
+
+    // lsn of the last record appended
+    uint64_t last_lsn();
+
+    // ask for records up to lsn to be synced, wait for it if wait
+    void commit(uint64_t lsn, bool wait);
+
+    // write and fsync everything appended so far
+    void sync();
+
+    // records in the file, up to the first broken one. A length past max_len
+    // or the end of the file is garbage of a torn tail, nothing is allocated for it.
+    std::vector<std::string> read_all(std::size_t max_len);
+
+    // drop all records, the tree has checkpointed them
+    void reset();
+
+    // nothing appended since open (or reset)
+    bool empty();
+
+protected:
+    std::string file_name_;
+    std::FILE *file_;
+    std::chrono::microseconds commit_window_;
+    std::mutex io_mutex_;  // held while the file is written, taken before mutex_
+    std::mutex mutex_;     // guards the members below
+    std::condition_variable wake_;     // the syncer has work
+    std::condition_variable durable_;  // durable_lsn_ moved
+    std::string buffer_;               // appended, not written yet
+    uint64_t next_lsn_;
+    uint64_t durable_lsn_;
+    bool commit_pending_;
+    bool file_empty_;
+    bool stop_;
+    std::string error_;  // an I/O error of the syncer, thrown to the next caller
+    std::thread syncer_;
+
+    // the syncer thread
+    void syncer_loop();
+
+    // write the buffer and fsync
+    void write_out();
+
+    // FNV-1a, enough to tell a torn record
+    static uint32_t checksum(const char *data, std::size_t len);
+};
+
+inline wal::wal(std::string file_name, std::chrono::microseconds commit_window) {
+    file_name_ = file_name;
+    commit_window_ = commit_window;
+    file_ = std::fopen(file_name_.c_str(), "ab");
+    if (file_ == nullptr) {
+        throw std::runtime_error("wal: can not open " + file_name_);
+    }
+    next_lsn_ = 1;
+    durable_lsn_ = 0;
+    commit_pending_ = false;
+    file_empty_ = false;  // not known until read_all()
+    stop_ = false;
+    syncer_ = std::thread(&wal::syncer_loop, this);
+}
+
+inline wal::~wal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    syncer_.join();
+    try {
+        write_out();
+    } catch (std::exception &) {
+        // nothing to do in a destructor, the records are lost
+    }
+    std::fclose(file_);
+}
+
+inline uint64_t wal::append(const char *data, std::size_t len) {
+    uint32_t header[2] = {uint32_t(len), checksum(data, len)};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_.empty()) {
+        throw std::runtime_error(error_);
+    }
+    buffer_.append(reinterpret_cast<const char *>(header), sizeof(header));
+    buffer_.append(data, len);
+    return next_lsn_++;
+}
+
+inline uint64_t wal::last_lsn() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_lsn_ - 1;
+}
+
+inline void wal::commit(uint64_t lsn, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (durable_lsn_ >= lsn) {
+        return;
+    }
+    commit_pending_ = true;
+    wake_.notify_one();
+    if (wait) {
+        durable_.wait(lock, [&] { return durable_lsn_ >= lsn || !error_.empty(); });
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+    }
+}
+
+inline void wal::sync() {
+    write_out();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_.empty()) {
+        throw std::runtime_error(error_);
+    }
+}
+
+inline std::vector<std::string> wal::read_all(std::size_t max_len) {
+    std::vector<std::string> records;
+    std::FILE *file = std::fopen(file_name_.c_str(), "rb");
+    if (file == nullptr) {
+        return records;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long left = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    uint32_t header[2];
+    while (std::fread(header, sizeof(header), 1, file) == 1) {
+        left -= sizeof(header);
+        if (header[0] > max_len || long(header[0]) > left) {
+            break;  // torn tail of a crash
+        }
+        left -= header[0];
+        std::string payload(header[0], '\0');
+        if (std::fread(&payload[0], 1, header[0], file) != header[0] ||
+            checksum(payload.data(), payload.size()) != header[1]) {
+            break;  // torn tail of a crash
+        }
+        records.emplace_back(std::move(payload));
+    }
+    std::fclose(file);
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_empty_ = records.empty();
+    return records;
+}
+
+inline void wal::reset() {
+    std::lock_guard<std::mutex> io(io_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_.clear();
+    std::FILE *file = std::freopen(file_name_.c_str(), "wb", file_);
+    if (file == nullptr) {
+        error_ = "wal: can not reopen " + file_name_;
+        throw std::runtime_error(error_);
+    }
+    file_ = file;
+    durable_lsn_ = next_lsn_ - 1;
+    file_empty_ = true;
+    durable_.notify_all();
+}
+
+inline bool wal::empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_empty_ && buffer_.empty();
+}
+
+inline void wal::syncer_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [&] { return stop_ || commit_pending_; });
+        if (stop_) {
+            return;
+        }
+        // let more commits join this fsync
+        wake_.wait_for(lock, commit_window_, [&] { return stop_; });
+        lock.unlock();
+        try {
+            write_out();
+        } catch (std::exception &e) {
+            std::lock_guard<std::mutex> relock(mutex_);
+            error_ = e.what();
+            durable_.notify_all();
+        }
+        lock.lock();
+    }
+}
+
+inline void wal::write_out() {
+    std::lock_guard<std::mutex> io(io_mutex_);
+    std::string out;
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.swap(buffer_);
+        lsn = next_lsn_ - 1;
+        commit_pending_ = false;
+    }
+    if (!out.empty()) {
+        if (std::fwrite(out.data(), 1, out.size(), file_) != out.size()) {
+            throw std::runtime_error("wal: write failed");
+        }
+        sync_file(file_);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        durable_lsn_ = std::max(durable_lsn_, lsn);
+        if (!out.empty()) {
+            file_empty_ = false;
+        }
+    }
+    durable_.notify_all();
+}
+
+inline uint32_t wal::checksum(const char *data, std::size_t len) {
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < len; ++i) {
+        hash = (hash ^ uint8_t(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+#endif  // INCLUDE_WAL_H_
@@ -38,6 +38,7 @@ int main() {
         std::cout << "7) Initialtion                     " << std::endl;
         std::cout << "->Added Methods<-------------------" << std::endl;
         std::cout << "8) Add Person                      " << std::endl;
+        std::cout << "9) Search people by status         " << std::endl;
         std::cout << "0) Quit                            " << std::endl;
         std::cout << "===================================" << std::endl;
         std::cout << "Please input your choice: ";
@@ -145,6 +146,11 @@ int main() {
         }
         case 7: {
             try {
+                std::ifstream roster("roster.in");
+                if (roster.is_open()) {
+                    nasys.ImportRoster(roster);
+                    roster.close();
+                }
                 std::ifstream ifs("line_up.in");
                 int n, m;
                 ifs >> n >> m;
@@ -161,12 +167,8 @@ int main() {
                 std::ifstream ifss("nucleic_acid_test.in");
                 int x, y;
                 ifss >> x >> y;
-                for (int i = 0; i < x; ++i) {
-                    nasys.AddExamine("01");
-                }
-                for (int i = 0; i < y; ++i) {
-                    nasys.AddExamine("00");
-                }
+                nasys.AddExamineBatch("01", x);
+                nasys.AddExamineBatch("00", y);
 
             } catch (const std::exception &e) {
                 std::cout << e.what() << std::endl;
@@ -195,6 +197,21 @@ int main() {
             getchar();
             break;
         }
+        case 9: {
+            try {
+                std::cout << "Please input the status (e.g. positive, close_cont): ";
+                PERSON_STATUS status;
+                std::cin >> status;
+                nasys.ShowStatus(status);
+            } catch (const std::exception &e) {
+                std::cout << e.what() << std::endl;
+            }
+            std::cout << "Press any key to continue..." << std::endl;
+            std::cin.clear();
+            std::cin.sync();
+            getchar();
+            break;
+        }
         case 0: return 0;
         }
     }
@@ -6,17 +6,59 @@
 
 #include "nucleic_acid_sys.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
+#include <iterator>
+#include <optional>
 #include <utility>
 
 #include "examine_log.h"
+#include "file_io.h"
 #include "person_log.h"
 #include "utils.h"
 
-NucleicAcidSys::NucleicAcidSys() : person("person"), examine("examine") {
+// a logged change returns only once it is on disk, callers meanwhile share the fsync
+static wal_options durable_log() {
+    wal_options options;
+    options.sync_commit = true;
+    return options;
+}
+
+// there while the system is open, so one found on open was left by a crash
+static const char RUNNING_MARK[] = "running.txt";
+
+NucleicAcidSys::NucleicAcidSys()
+    : person("person", DEFAULT_POOL_SIZE, durable_log()),
+      examine("examine", DEFAULT_POOL_SIZE, durable_log()),
+      by_status("by_status") {
+    // contact tracing looks up many people who are not there
+    person.set_leaf_filters();
+    // reports scan whole buildings and tubes, read the leaves after them meanwhile
+    person.set_readahead(8);
+    examine.set_readahead(8);
+    // people from before the index, or a crash between a person and the
+    // index (they have logs of their own, the mark tells), the index is
+    // built or mended
+    struct stat buf;
+    bool crashed = stat(RUNNING_MARK, &buf) == 0;
+    if ((by_status.empty() && !person.empty()) || crashed) {
+        sync_status_index();
+    }
+    std::FILE *mark = std::fopen(RUNNING_MARK, "w");
+    if (mark == nullptr) {
+        throw std::runtime_error("NucleicAcidSys: can not create " + std::string(RUNNING_MARK));
+    }
+    try {
+        sync_file(mark);
+    } catch (std::exception &) {
+        std::fclose(mark);
+        throw;
+    }
+    std::fclose(mark);
     std::string file = "data.txt";
     // load the single_serial, multiple_serial, multiple_coutner;
-    struct stat buf;
     errno_t err = 0;
     if (stat(std::string(file).c_str(), &buf) != 0) {
         single_serial = 10000;
@@ -51,22 +93,64 @@ NucleicAcidSys::~NucleicAcidSys() {
         ofs << queue_coutner[i] << ' ';
     }
     ofs.close();
+    // the index is on disk as far as person is, nothing to mend next time
+    by_status.sync();
+    std::remove(RUNNING_MARK);
 }
 
 void NucleicAcidSys::AddPerson(const id_t<8> &id, const std::string &name) {
+    if (name.length() > person_log::NAME_SIZE) {
+        throw std::runtime_error("AddPerson: name too long");
+    }
     person_log log;
     log.id = id;
     log.name = name;
     log.status = not_examined;
     log.update_time = time(NULL);
     person.insert(id, log);
+    by_status.insert(status_key(log.status, id), 0);
+}
+
+void NucleicAcidSys::ImportRoster(std::istream &is) {
+    int n;
+    is >> n;
+    std::vector<std::pair<id_t<8>, person_log>> records;
+    std::vector<std::pair<status_key, uint8_t>> statuses;
+    records.reserve(n);
+    statuses.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        person_log log;
+        is >> log.id >> log.name;
+        // nothing is imported if one is refused
+        if (log.name.length() > person_log::NAME_SIZE) {
+            throw std::runtime_error("ImportRoster: name too long");
+        }
+        log.status = not_examined;
+        log.update_time = time(NULL);
+        records.emplace_back(log.id, log);
+        statuses.emplace_back(status_key(log.status, log.id), 0);
+    }
+    if (person.empty()) {
+        // build the trees bottom-up, much faster than one insert per person
+        person.bulk_load(std::move(records));
+    } else {
+        person.insert_batch(std::move(records));
+    }
+    if (by_status.empty()) {
+        by_status.bulk_load(std::move(statuses));
+    } else {
+        by_status.insert_batch(std::move(statuses));
+    }
 }
 
 void NucleicAcidSys::EnquePerson(const id_t<8> &id, const id_t<2> &queue_id) {
+    PERSON_STATUS old = not_examined;
     person.search(id, [&](auto &log) {
+        old = log.status;
         log.status = queueing;
         log.update_time = time(NULL);
     });
+    move_status({{id, old}}, queueing);
     // enqueue
     logging_queue[int(queue_id)].emplace_back(id);
 }
@@ -81,6 +165,48 @@ void NucleicAcidSys::AddExamine(const id_t<2> &queue_id) {
 }
 
 void NucleicAcidSys::AddExamine(const id_t<8> &person_id, const id_t<2> &queue_id, bool mode) {
+    auto item = make_examine(person_id, queue_id, mode);
+    examine.insert(item.first, item.second);
+    // change person status to wait for upload
+    PERSON_STATUS old = not_examined;
+    person.search(person_id, [&](person_log &log) {
+        old = log.status;
+        log.status = waiting_for_uploading;
+        log.update_time = time(NULL);
+    });
+    move_status({{person_id, old}}, waiting_for_uploading);
+}
+
+void NucleicAcidSys::AddExamineBatch(const id_t<2> &queue_id, int count) {
+    bool mode = (queue_id == id_t<2>(0));
+    auto &queue = logging_queue[int(queue_id)];
+    std::size_t n = std::min<std::size_t>(std::max(count, 0), queue.size());
+    // everyone must be there before anyone leaves the queue or gets a serial
+    std::vector<id_t<8>> person_ids(queue.begin(), queue.begin() + n);
+    for (auto &log : person.multi_get(person_ids)) {
+        if (!log) {
+            throw std::runtime_error("AddExamineBatch: person not found!");
+        }
+    }
+    std::vector<std::pair<examine_key, examine_log>> items;
+    for (auto &person_id : person_ids) {
+        queue.pop_front();
+        items.emplace_back(make_examine(person_id, queue_id, mode));
+    }
+    examine.insert_batch(std::move(items));
+    // change their status to wait for upload
+    std::vector<std::pair<id_t<8>, PERSON_STATUS>> moved;
+    person.multi_update(std::move(person_ids), [&moved](person_log &log) {
+        moved.emplace_back(log.id, log.status);
+        log.status = waiting_for_uploading;
+        log.update_time = time(NULL);
+    });
+    move_status(moved, waiting_for_uploading);
+}
+
+std::pair<examine_key, examine_log> NucleicAcidSys::make_examine(const id_t<8> &person_id,
+                                                                const id_t<2> &queue_id,
+                                                                bool mode) {
     examine_log log;
     if (mode == 0) {
         log.id = ++multiple_serial;
@@ -92,20 +218,13 @@ void NucleicAcidSys::AddExamine(const id_t<8> &person_id, const id_t<2> &queue_i
     log.status = waitfor_uploading;
     log.update_time = time(NULL);
     if (mode == 0) {
-        examine.insert(std::string(log.id) + std::string(queue_id) +
-                           std::to_string(++queue_coutner[int(queue_id)]),
-                       log);
+        examine_key key(log.id, queue_id, uint8_t(++queue_coutner[int(queue_id)]));
         if (queue_coutner[int(queue_id)] == 10) {
             queue_coutner[int(queue_id)] = 0;
         }
-    } else {
-        examine.insert(std::string(log.id) + std::string(queue_id) + std::to_string(0), log);
+        return std::make_pair(key, log);
     }
-    // change person status to wait for upload
-    person.search(person_id, [&](person_log &log) {
-        log.status = waiting_for_uploading;
-        log.update_time = time(NULL);
-    });
+    return std::make_pair(examine_key(log.id, queue_id, 0), log);
 }
 
 void NucleicAcidSys::ShowQueue() {
@@ -135,7 +254,7 @@ void NucleicAcidSys::AddTubeResult(id_t<5> id, RESULT_STATUS result) {
     std::vector<id_t<8>> person_ids;
     std::vector<int> orders;
     id_t<2> queue_id;
-    examine.search(std::string(id) + "000", std::string(id) + "999",
+    examine.search(examine_key::min_with(id), examine_key::max_with(id),
                    [&result, &person_ids, &queue_id, &orders](examine_log &log) {
                        log.status = result;
                        log.update_time = time(NULL);
@@ -144,24 +263,37 @@ void NucleicAcidSys::AddTubeResult(id_t<5> id, RESULT_STATUS result) {
                        orders.emplace_back(log.order);
                    });
     bool flag = false;
-    for (auto &person_id : person_ids) {
-        person.search(person_id, [&result, &person_ids, &flag](person_log &log) {
-            if (result == posi) {
-                if (person_ids.size() == 1) {
-                    log.status = positive;
-                    flag = true;
+    // people of the tube by their status before, and the one they get
+    std::vector<std::pair<id_t<8>, PERSON_STATUS>> moved;
+    PERSON_STATUS tube_status =
+        result != posi ? negative : person_ids.size() == 1 ? positive : suspicious;
+    try {
+        for (auto &person_id : person_ids) {
+            person.search(person_id, [&result, &person_ids, &flag, &moved](person_log &log) {
+                if (result != posi && result != nega) {
+                    throw std::runtime_error("AddTubeResult: invalid result");
+                }
+                moved.emplace_back(log.id, log.status);
+                if (result == posi) {
+                    if (person_ids.size() == 1) {
+                        log.status = positive;
+                        flag = true;
+                    } else {
+                        log.status = suspicious;
+                    }
                 } else {
-                    log.status = suspicious;
+                    log.status = negative;
                 }
                 log.update_time = time(NULL);
-            } else if (result == nega) {
-                log.status = negative;
-                log.update_time = time(NULL);
-            } else {
-                throw std::runtime_error("AddTubeResult: invalid result");
-            }
-        });
+            });
+        }
+    } catch (std::exception &) {
+        // the people changed so far move in the index all the same
+        move_status(moved, tube_status);
+        throw;
     }
+    move_status(moved, tube_status);
+    moved.clear();
     std::vector<id_t<8>> close_guys;
     std::vector<id_t<8>> sec_close_guys;
     if (flag) {
@@ -169,77 +301,68 @@ void NucleicAcidSys::AddTubeResult(id_t<5> id, RESULT_STATUS result) {
         auto posi_guy = person_ids[0];
         auto posi_guy_queue = queue_id;
         auto order = orders[0];
-        auto building_id = std::string(posi_guy).substr(0, 3);
+        auto building_id = posi_guy.prefix<3>();
         try {
-            person.search(building_id + "00000", building_id + "99999",
-                          [&posi_guy, &close_guys](person_log &log) {
-                              if (log.id != posi_guy) {
-                                  close_guys.emplace_back(log.id);
-                              }
-                          });
+            person.read(id_t<8>::min_with(building_id), id_t<8>::max_with(building_id),
+                        [&posi_guy, &close_guys](const person_log &log) {
+                            if (log.id != posi_guy) {
+                                close_guys.emplace_back(log.id);
+                            }
+                        });
         } catch (std::runtime_error &e) {
             ;
         }
-        std::vector<id_t<8>> close_ids;
-        auto start_num = int(id) - 1 > 10000 ? int(id) - 1 : 10000;
-        auto end_num = int(id) + 1 < 99999 ? int(id) + 1 : 99999;
-        auto start = std::to_string(start_num) + "000";
-        auto end = std::to_string(end_num) + "009";
-        // queue search
-        try {
-            examine.search(start, end, [&close_ids](examine_log &log) {
-                close_ids.emplace_back(log.person_id);
-            });
-        } catch (std::runtime_error &e) {
-            ;
-        }
-        int pos_posi_guy = 0;
-        while (close_ids[pos_posi_guy] != posi_guy) {
-            pos_posi_guy++;
-        }
+        // queue search, walk from the positive guy's log
+        // 10 people before him and 1 after
         std::vector<id_t<8>> sec_close_ids;
-        for (int i = (pos_posi_guy - 10 > 0 ? pos_posi_guy - 10 : 0); i < pos_posi_guy; i++) {
-            sec_close_ids.emplace_back(close_ids[i]);
+        // only within this tube, the log may not be there
+        auto cur = examine.lower_bound(examine_key::min_with(id));
+        auto tube_end = examine_key::max_with(id);
+        while (!cur.end() && cur.key() <= tube_end && cur.value().person_id != posi_guy) {
+            cur.next();
         }
-        sec_close_ids.emplace_back(close_ids[pos_posi_guy + 1]);
-        for (auto &item : sec_close_ids) {
-            try {
-                person.search(item, [this, &close_guys, &sec_close_guys](person_log &log) {
-                    close_guys.emplace_back(log.id);
-                    auto posi_guy = log.id;
-                    auto building_id = std::string(posi_guy).substr(0, 3);
-                    person.search(building_id + "00000", building_id + "99999",
-                                  [&posi_guy, &sec_close_guys](person_log &log) {
-                                      if (log.id != posi_guy) {
-                                          sec_close_guys.emplace_back(log.id);
-                                      }
-                                  });
-                });
-            } catch (std::runtime_error &e) {
-                ;
+        if (!cur.end() && cur.key() <= tube_end) {
+            auto before = cur;
+            for (int i = 0; i < 10; ++i) {
+                before.prev();
+                if (before.end()) {
+                    break;
+                }
+                sec_close_ids.emplace_back(before.value().person_id);
+            }
+            cur.next();
+            if (!cur.end()) {
+                sec_close_ids.emplace_back(cur.value().person_id);
             }
         }
-    }
-    for (auto &item : close_guys) {
-        try {
-            person.search(item, [this, &queue_id, &orders](person_log &log) {
-                log.status = close_contact;
-                log.update_time = time(NULL);
-            });
-        } catch (std::runtime_error &e) {
-            ;
-        }
-    }
-    for (auto &item : sec_close_guys) {
-        try {
-            person.search(item, [this, &queue_id, &orders](person_log &log) {
-                log.status = secondary_close_contact;
-                log.update_time = time(NULL);
-            });
-        } catch (std::runtime_error &e) {
-            ;
+        // all of them in one pass, a miss is skipped
+        for (auto &log : person.multi_get(sec_close_ids)) {
+            if (!log) {
+                continue;
+            }
+            close_guys.emplace_back(log->id);
+            auto building_id = log->id.prefix<3>();
+            person.read(id_t<8>::min_with(building_id), id_t<8>::max_with(building_id),
+                        [&log, &sec_close_guys](const person_log &other) {
+                            if (other.id != log->id) {
+                                sec_close_guys.emplace_back(other.id);
+                            }
+                        });
         }
     }
+    person.multi_update(std::move(close_guys), [&moved](person_log &log) {
+        moved.emplace_back(log.id, log.status);
+        log.status = close_contact;
+        log.update_time = time(NULL);
+    });
+    move_status(moved, close_contact);
+    moved.clear();
+    person.multi_update(std::move(sec_close_guys), [&moved](person_log &log) {
+        moved.emplace_back(log.id, log.status);
+        log.status = secondary_close_contact;
+        log.update_time = time(NULL);
+    });
+    move_status(moved, secondary_close_contact);
 }
 
 void NucleicAcidSys::ShowStatus() {
@@ -255,9 +378,24 @@ void NucleicAcidSys::ShowStatus() {
     }
 }
 
+void NucleicAcidSys::ShowStatus(PERSON_STATUS status) {
+    std::vector<person_log> logs = get_status(status);
+    std::cout << std::setw(9) << "ID" << std::setw(10) << "Name" << std::setw(12) << "Status"
+              << std::setw(18) << "Update Time" << std::endl;
+    if (logs.size() == 0) {
+        std::cout << "Nobody is " << status << "." << std::endl;
+        return;
+    }
+    for (auto &log : logs) {
+        std::cout << std::setw(9) << log.id << std::setw(10) << log.name << std::setw(12)
+                  << log.status << std::setw(18) << DatetimeToString(log.update_time)
+                  << std::endl;
+    }
+}
+
 void NucleicAcidSys::ShowPersonalInfo(id_t<8> id, time_t time) {
     person_log log;
-    person.search(id, [&](auto &log) {
+    person.read(id, [&](auto &log) {
         std::cout << "ID: " << log.id << std::endl;
         std::cout << "Name: " << log.name << std::endl;
         if (log.update_time < time) {
@@ -274,22 +412,110 @@ void NucleicAcidSys::ShowPersonalInfo(id_t<8> id, time_t time) {
 }
 
 std::vector<std::pair<id_t<2>, person_log>> NucleicAcidSys::get_queue() {
+    // everyone queued in one pass over the person tree
+    std::vector<id_t<8>> ids;
+    for (int i = 0; i < queue_num; i++) {
+        ids.insert(ids.end(), logging_queue[i].begin(), logging_queue[i].end());
+    }
+    auto logs = person.multi_get(ids);
     std::vector<std::pair<id_t<2>, person_log>> queue;
+    std::size_t k = 0;
     for (int i = 0; i < queue_num; i++) {
-        for (auto &item : logging_queue[i]) {
-            this->person.search(item, [&queue, &item, &i](person_log log) {
-                queue.emplace_back(std::make_pair(i, log));
-            });
+        for (std::size_t j = 0; j < logging_queue[i].size(); ++j, ++k) {
+            if (logs[k]) {
+                queue.emplace_back(i, *logs[k]);
+            }
         }
     }
     return queue;
 }
 
 std::map<PERSON_STATUS, std::vector<person_log>> NucleicAcidSys::get_status() {
-    std::map<PERSON_STATUS, std::vector<person_log>> map;
-    person.search(id_t<8>("00000000"), id_t<8>("99999999"),
-                  [&map](person_log item) { map[item.status].emplace_back(item); });
-    return map;
+    // every person as of one moment, AddTubeResult may go on meanwhile,
+    // a slice of ids per thread, then put the slices together in order
+    typedef std::map<PERSON_STATUS, std::vector<person_log>> status_map;
+    return person.take_snapshot().parallel_scan<status_map>(
+        id_t<8>(0), id_t<8>(id_t<8>::LIMIT - 1),
+        [](status_map &part, const id_t<8> &, const person_log &log) {
+            part[log.status].emplace_back(log);
+        },
+        [](status_map &map, status_map &&part) {
+            for (auto &item : part) {
+                auto &logs = map[item.first];
+                logs.insert(logs.end(), std::make_move_iterator(item.second.begin()),
+                            std::make_move_iterator(item.second.end()));
+            }
+        });
+}
+
+std::vector<person_log> NucleicAcidSys::get_status(PERSON_STATUS status) {
+    // the ids from the index, then their logs in one pass over the person tree
+    std::vector<id_t<8>> ids;
+    for (auto cur = by_status.lower_bound(status_key::min_with(status));
+         !cur.end() && cur.key() <= status_key::max_with(status); cur.next()) {
+        id_t<8> id = cur.key().get<1>();
+        if (ids.empty() || ids.back() != id) {
+            ids.emplace_back(id);
+        }
+    }
+    std::vector<person_log> logs;
+    for (auto &log : person.multi_get(ids)) {
+        // skip anyone who has moved on meanwhile
+        if (log && log->status == status) {
+            logs.emplace_back(std::move(*log));
+        }
+    }
+    return logs;
+}
+
+void NucleicAcidSys::move_status(const std::vector<std::pair<id_t<8>, PERSON_STATUS>> &moved,
+                                 PERSON_STATUS status) {
+    std::vector<std::pair<status_key, uint8_t>> keys;
+    for (auto &item : moved) {
+        if (item.second == status) {
+            continue;
+        }
+        by_status.remove(status_key(item.second, item.first));
+        keys.emplace_back(status_key(status, item.first), 0);
+    }
+    if (!keys.empty()) {
+        by_status.insert_batch(std::move(keys));
+    }
+}
+
+void NucleicAcidSys::sync_status_index() {
+    // what the index should hold, in key order
+    std::vector<std::pair<status_key, uint8_t>> expected;
+    for (auto cur = person.first(); !cur.end(); cur.next()) {
+        expected.emplace_back(status_key(cur.value().status, cur.key()), 0);
+    }
+    std::sort(expected.begin(), expected.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    if (by_status.empty()) {
+        by_status.bulk_load(std::move(expected));
+        return;
+    }
+    // walk both in order, entries not expected go and expected ones not there come
+    std::vector<status_key> extra;
+    std::vector<std::pair<status_key, uint8_t>> missing;
+    auto it = expected.begin();
+    for (auto cur = by_status.first(); !cur.end(); cur.next()) {
+        while (it != expected.end() && it->first < cur.key()) {
+            missing.emplace_back(*it++);
+        }
+        if (it != expected.end() && it->first == cur.key()) {
+            ++it;
+        } else {
+            extra.emplace_back(cur.key());
+        }
+    }
+    missing.insert(missing.end(), it, expected.end());
+    for (auto &key : extra) {
+        by_status.remove(key);
+    }
+    if (!missing.empty()) {
+        by_status.insert_batch(std::move(missing));
+    }
 }
 
 id_t<8> NucleicAcidSys::GetQueueFront(id_t<2> queue_id) {